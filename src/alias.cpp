@@ -0,0 +1,156 @@
+//========================================================//
+//  alias.cpp                                             //
+//  Source file for the table aliasing analyzer           //
+//                                                        //
+//  The reference predictions live in a hash map keyed    //
+//  by (branch, entry), as only the pairs a trace         //
+//  actually touches are worth storing                    //
+//========================================================//
+#include "alias.h"
+#include <algorithm>
+#include <stdlib.h>
+#include <unordered_map>
+#include <vector>
+
+// Owner of an entry no branch has trained yet
+#define NO_OWNER UINT32_MAX
+
+// Most tables of a predictor analyzed
+#define MAX_TABLES 8
+
+alias_report alias_analyze(Predictor *predictor, const branch_trace &trace,
+                           uint64_t warmup) {
+  alias_report report = {0, NULL};
+  uint32_t size;
+  while (report.num_tables < MAX_TABLES &&
+         predictor->table(report.num_tables, &size) != NULL)
+    report.num_tables++;
+  report.tables =
+      (alias_table *)calloc(report.num_tables + 1, sizeof(alias_table));
+  for (int t = 0; t < report.num_tables; t++) {
+    alias_table *table = &report.tables[t];
+    table->name = predictor->table(t, &table->size);
+    table->entries = (alias_entry *)calloc(table->size, sizeof(alias_entry));
+    for (uint32_t e = 0; e < table->size; e++)
+      table->entries[e].owner = NO_OWNER;
+  }
+
+  // Prediction of each entry right after each branch last trained it
+  std::vector<std::unordered_map<uint64_t, uint8_t>> reference(
+      report.num_tables);
+  uint32_t entries[MAX_TABLES];
+  uint8_t *refs[MAX_TABLES];
+
+  for (uint64_t i = 0; i < trace.count; i++) {
+    uint32_t pc = trace.pc[i];
+    uint8_t flags = trace.flags[i];
+    uint32_t outcome = (flags & TRACE_OUTCOME) != 0;
+    uint32_t condition = (flags & TRACE_CONDITION) != 0;
+
+    if (condition) {
+      uint32_t id = trace.pcid[i];
+      predictor->table_entries(pc, entries);
+      for (int t = 0; t < report.num_tables; t++) {
+        alias_entry *entry = &report.tables[t].entries[entries[t]];
+        auto [ref, first] = reference[t].try_emplace(
+            (uint64_t)id << 32 | entries[t], (uint8_t)0);
+        refs[t] = &ref->second;
+        if (first)
+          entry->branches++;
+        if (i < warmup)
+          continue;
+
+        entry->accesses++;
+        if (entry->owner == NO_OWNER || entry->owner == id)
+          continue;
+        entry->aliased++;
+        if (first)
+          continue;
+        uint32_t right = predictor->table_prediction(t, entries[t]) == outcome;
+        uint32_t ref_right = *refs[t] == outcome;
+        entry->constructive += right && !ref_right;
+        entry->destructive += !right && ref_right;
+      }
+    }
+
+    predictor->train(pc, trace.target[i], outcome, condition,
+                     (flags & TRACE_CALL) != 0, (flags & TRACE_RET) != 0,
+                     (flags & TRACE_DIRECT) != 0);
+
+    if (condition) {
+      for (int t = 0; t < report.num_tables; t++) {
+        *refs[t] = predictor->table_prediction(t, entries[t]);
+        report.tables[t].entries[entries[t]].owner = trace.pcid[i];
+      }
+    }
+  }
+
+  return report;
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+  return whole ? 100.0 * part / whole : 0;
+}
+
+void print_alias_report(FILE *out, const alias_report *report, int top) {
+  fprintf(out, "%-10s %8s %7s %12s %8s %8s %8s %8s\n", "Table", "Entries",
+          "Used %", "Accesses", "Alias %", "Constr %", "Destr %", "Neutr %");
+  for (int t = 0; t < report->num_tables; t++) {
+    const alias_table &table = report->tables[t];
+    uint64_t used = 0, accesses = 0, aliased = 0, constructive = 0,
+             destructive = 0;
+    for (uint32_t e = 0; e < table.size; e++) {
+      const alias_entry &entry = table.entries[e];
+      used += entry.accesses != 0;
+      accesses += entry.accesses;
+      aliased += entry.aliased;
+      constructive += entry.constructive;
+      destructive += entry.destructive;
+    }
+    fprintf(out, "%-10s %8u %7.2f %12llu %8.2f %8.2f %8.2f %8.2f\n",
+            table.name, table.size, percent(used, table.size),
+            (unsigned long long)accesses, percent(aliased, accesses),
+            percent(constructive, accesses), percent(destructive, accesses),
+            percent(aliased - constructive - destructive, accesses));
+  }
+
+  // Hottest conflicts over all tables, most destructive first
+  std::vector<std::pair<int, uint32_t>> hot;
+  for (int t = 0; t < report->num_tables; t++) {
+    for (uint32_t e = 0; e < report->tables[t].size; e++) {
+      if (report->tables[t].entries[e].aliased)
+        hot.push_back({t, e});
+    }
+  }
+  size_t shown = std::min(hot.size(), (size_t)top);
+  auto entry = [&](const std::pair<int, uint32_t> &at) -> const alias_entry & {
+    return report->tables[at.first].entries[at.second];
+  };
+  std::partial_sort(hot.begin(), hot.begin() + shown, hot.end(),
+                    [&](const std::pair<int, uint32_t> &a,
+                        const std::pair<int, uint32_t> &b) {
+                      if (entry(a).destructive != entry(b).destructive)
+                        return entry(a).destructive > entry(b).destructive;
+                      if (entry(a).aliased != entry(b).aliased)
+                        return entry(a).aliased > entry(b).aliased;
+                      return a < b;
+                    });
+
+  fprintf(out, "\n%-10s %8s %8s %12s %10s %12s %11s\n", "Table", "Entry",
+          "Branches", "Accesses", "Aliased", "Constructive", "Destructive");
+  for (size_t r = 0; r < shown; r++) {
+    const alias_entry &hottest = entry(hot[r]);
+    fprintf(out, "%-10s %8x %8u %12llu %10llu %12llu %11llu\n",
+            report->tables[hot[r].first].name, hot[r].second,
+            hottest.branches, (unsigned long long)hottest.accesses,
+            (unsigned long long)hottest.aliased,
+            (unsigned long long)hottest.constructive,
+            (unsigned long long)hottest.destructive);
+  }
+}
+
+void alias_free(alias_report *report) {
+  for (int t = 0; t < report->num_tables; t++)
+    free(report->tables[t].entries);
+  free(report->tables);
+}
@@ -0,0 +1,60 @@
+//========================================================//
+//  alias.h                                               //
+//  Header file for the table aliasing analyzer           //
+//                                                        //
+//  Follows which static branches share each entry of a   //
+//  predictor's tables and whether sharing helped or hurt //
+//  their predictions, to size and hash the tables on     //
+//  data                                                  //
+//========================================================//
+
+#ifndef ALIAS_H
+#define ALIAS_H
+
+#include "predictor.h"
+#include "trace.h"
+#include <stdio.h>
+
+// A counted access to a table entry is aliased if another static branch
+// trained the entry last. Its reference is the prediction the entry gave
+// right after the accessing branch itself last trained it: the aliasing
+// was constructive if it turned a wrong reference into a right prediction,
+// destructive if the other way round and neutral otherwise, including
+// when the branch never trained the entry before.
+typedef struct {
+  uint32_t owner;        // Trace pcid of the last branch to train it
+  uint32_t branches;     // Distinct branches that trained it
+  uint64_t accesses;     // Counted accesses
+  uint64_t aliased;      // Of which aliased
+  uint64_t constructive; // Of which constructive
+  uint64_t destructive;  // Of which destructive
+} alias_entry;
+
+typedef struct {
+  const char *name;
+  uint32_t size;
+  alias_entry *entries;
+} alias_table;
+
+typedef struct {
+  int num_tables;
+  alias_table *tables;
+} alias_report;
+
+// Runs 'predictor' over 'trace', training it on every record but counting
+// only those past the first 'warmup', and follows the aliasing in each of
+// its tables (see Predictor::table)
+//
+// Returns the report, with no tables if the predictor has none
+//
+alias_report alias_analyze(Predictor *predictor, const branch_trace &trace,
+                           uint64_t warmup);
+
+// Prints the alias rates of each table, then the 'top' entries of all
+// tables with the most destructive aliasing
+//
+void print_alias_report(FILE *out, const alias_report *report, int top);
+
+void alias_free(alias_report *report);
+
+#endif
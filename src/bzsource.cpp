@@ -0,0 +1,552 @@
+//========================================================//
+//  bzsource.cpp                                          //
+//  Source file for the bzip2 trace source                //
+//                                                        //
+//  Serial mode: a producer thread owns the libbz2 stream //
+//  and fills fixed size chunks; the consumer (the trace  //
+//  reader) takes them in order. Head and tail are the    //
+//  only shared state, so no locks are needed.            //
+//                                                        //
+//  Parallel mode: the compressed blocks are located up   //
+//  front and decoded independently by a pool of workers; //
+//  the consumer stitches them back together in order. A  //
+//  block that fails to decode switches the source over   //
+//  to serial mode, picking up where the blocks left off  //
+//========================================================//
+#include "bzsource.h"
+#include "trace.h"
+#include <atomic>
+#include <bzlib.h>
+#include <condition_variable>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#define BZ_CHUNK_SIZE (1 << 20) // Bytes of trace per ring chunk
+#define BZ_RING_CHUNKS 8        // Chunks in flight between the threads
+#define BZ_BLOCKS_PER_WORKER 2  // Decoded blocks buffered per worker
+
+// 48-bit markers that start each compressed block and end each stream
+#define BZ_BLOCK_MAGIC 0x314159265359ull
+#define BZ_EOS_MAGIC 0x177245385090ull
+
+int trace_decode_threads = 0;
+
+// A compressed block, located by bit offsets into the input
+typedef struct {
+  uint64_t start_bit; // first bit of the block magic
+  uint64_t end_bit;   // first bit of the following marker
+  uint8_t *out;       // decoded bytes, owned until the consumer takes them
+  size_t out_len;
+  int state; // 0 pending, 1 decoded, -1 corrupt
+} bz_block;
+
+struct bz_source {
+  const uint8_t *in;
+  size_t in_len;
+
+  // Record boundary state, used by whichever side cuts the chunks
+  int binary;    // format, known after the first bytes are decoded
+  size_t header; // binary header bytes still at the chunk start
+  int error;
+
+  // Serial mode. Chunk i lives in ring[i % BZ_RING_CHUNKS]; a zero length
+  // chunk marks the end of the stream
+  uint8_t *ring[BZ_RING_CHUNKS];
+  size_t ring_len[BZ_RING_CHUNKS];
+  uint8_t *spill;             // a record split across two chunks
+  std::atomic<uint64_t> head; // chunks published by the producer
+  std::atomic<uint64_t> tail; // chunks released by the consumer
+  std::atomic<bool> stop;
+  bool started; // consumer holds chunk tail-1
+  std::thread producer;
+  size_t discard; // decoded bytes already handed out in parallel mode
+
+  // Parallel mode. Workers claim blocks in order but never run more than
+  // 'window' blocks ahead of the consumer
+  bool parallel;
+  std::vector<bz_block> blocks;
+  size_t claimed;  // next block for a worker
+  size_t consumed; // next block for the consumer
+  size_t window;
+  std::mutex lock;
+  std::condition_variable decoded; // a block finished decoding
+  std::condition_variable room;    // the consumer took a block
+  std::vector<std::thread> workers;
+  uint8_t *chunk; // stitched output handed to the consumer
+  size_t chunk_cap;
+  size_t spill_len;
+  size_t spill_cap;
+  size_t handed; // bytes handed to the consumer so far
+};
+
+int bz_is_bzip2(const uint8_t *data, size_t len) {
+  return len >= 4 && !memcmp(data, "BZh", 3) && data[3] >= '1' &&
+         data[3] <= '9';
+}
+
+// Returns the length of the prefix of 'buf' that ends on a record
+// boundary, detecting the trace format from the very first chunk.
+// The final chunk of the stream is always taken whole.
+//
+static size_t record_cut(bz_source *src, const uint8_t *buf, size_t len,
+                         int last) {
+  if (src->binary < 0 && (len >= TRACE_MAGIC_LEN || last)) {
+    src->binary = len >= TRACE_MAGIC_LEN &&
+                  !memcmp(buf, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    src->header = src->binary ? TRACE_HEADER_SIZE : 0;
+  }
+  if (last)
+    return len;
+
+  size_t cut = 0;
+  if (src->binary > 0) {
+    if (len >= src->header)
+      cut = src->header + (len - src->header) / TRACE_RECORD_SIZE *
+                              TRACE_RECORD_SIZE;
+  } else if (src->binary == 0) {
+    const uint8_t *nl = (const uint8_t *)memrchr(buf, '\n', len);
+    cut = nl ? (size_t)(nl - buf) + 1 : 0;
+  }
+  if (cut > 0)
+    src->header = 0;
+  return cut;
+}
+
+//------------------------------------//
+//            Serial Mode             //
+//------------------------------------//
+
+static void produce(bz_source *src) {
+  bz_stream bz;
+  memset(&bz, 0, sizeof(bz));
+  int rc = BZ2_bzDecompressInit(&bz, 0, 0);
+  bz.next_in = (char *)src->in;
+  bz.avail_in = 0;
+  size_t in_left = src->in_len;
+
+  size_t carry = 0; // bytes of a split record waiting in 'spill'
+  uint64_t head = 0;
+  int finished = (rc != BZ_OK);
+  src->error = finished;
+
+  while (!finished && !src->stop.load(std::memory_order_relaxed)) {
+    // Wait for a free chunk
+    uint64_t tail = src->tail.load(std::memory_order_acquire);
+    while (head - tail == BZ_RING_CHUNKS) {
+      src->tail.wait(tail, std::memory_order_acquire);
+      tail = src->tail.load(std::memory_order_acquire);
+      if (src->stop.load(std::memory_order_relaxed))
+        break;
+    }
+    if (src->stop.load(std::memory_order_relaxed))
+      break;
+
+    uint8_t *buf = src->ring[head % BZ_RING_CHUNKS];
+    memcpy(buf, src->spill, carry);
+    bz.next_out = (char *)buf + carry;
+    bz.avail_out = BZ_CHUNK_SIZE - carry;
+
+    while (bz.avail_out > 0) {
+      if (bz.avail_in == 0) {
+        // Feed the input in pieces, avail_in is only 32 bits wide
+        bz.avail_in = in_left < (1u << 30) ? in_left : (1u << 30);
+        in_left -= bz.avail_in;
+      }
+      rc = BZ2_bzDecompress(&bz);
+      if (rc == BZ_STREAM_END) {
+        // Concatenated streams carry on with the remaining input
+        BZ2_bzDecompressEnd(&bz);
+        size_t rest = bz.avail_in + in_left;
+        if (rest < 4 || !bz_is_bzip2((const uint8_t *)bz.next_in, rest)) {
+          finished = 1;
+          break;
+        }
+        char *next_in = bz.next_in;
+        unsigned int avail_in = bz.avail_in;
+        char *next_out = bz.next_out;
+        unsigned int avail_out = bz.avail_out;
+        memset(&bz, 0, sizeof(bz));
+        BZ2_bzDecompressInit(&bz, 0, 0);
+        bz.next_in = next_in;
+        bz.avail_in = avail_in;
+        bz.next_out = next_out;
+        bz.avail_out = avail_out;
+      } else if (rc != BZ_OK ||
+                 (bz.avail_in == 0 && in_left == 0 && bz.avail_out > 0)) {
+        // Corrupt or truncated input
+        src->error = 1;
+        finished = 1;
+        BZ2_bzDecompressEnd(&bz);
+        break;
+      }
+    }
+
+    size_t len = BZ_CHUNK_SIZE - bz.avail_out;
+    if (src->discard > 0) {
+      // Output the consumer already has; nothing is carried over while
+      // discarding, as no chunk has been cut yet
+      size_t drop = len < src->discard ? len : src->discard;
+      memmove(buf, buf + drop, len - drop);
+      len -= drop;
+      src->discard -= drop;
+      if (len == 0 && !finished)
+        continue;
+    }
+    size_t cut = record_cut(src, buf, len, finished);
+    if (cut == 0 && len > 0) {
+      // A single record larger than a chunk, not a trace
+      src->error = 1;
+      finished = 1;
+      cut = len;
+    }
+
+    // The split record moves to the front of the next chunk
+    carry = len - cut;
+    memcpy(src->spill, buf + cut, carry);
+    buf[cut] = '\0';
+    src->ring_len[head % BZ_RING_CHUNKS] = cut;
+
+    if (cut > 0) {
+      src->head.store(++head, std::memory_order_release);
+      src->head.notify_one();
+    }
+  }
+  if (!finished)
+    BZ2_bzDecompressEnd(&bz);
+
+  // Publish the end of stream marker once there is room for it
+  uint64_t tail = src->tail.load(std::memory_order_acquire);
+  while (head - tail == BZ_RING_CHUNKS && !src->stop.load()) {
+    src->tail.wait(tail, std::memory_order_acquire);
+    tail = src->tail.load(std::memory_order_acquire);
+  }
+  src->ring_len[head % BZ_RING_CHUNKS] = 0;
+  src->head.store(head + 1, std::memory_order_release);
+  src->head.notify_one();
+}
+
+static int next_serial(bz_source *src, const uint8_t **chunk, size_t *len) {
+  uint64_t tail = src->tail.load(std::memory_order_relaxed);
+  if (src->started) {
+    // Release the chunk the consumer was holding
+    src->tail.store(++tail, std::memory_order_release);
+    src->tail.notify_one();
+  }
+  src->started = true;
+
+  // Wait for the chunk at 'tail' to be published
+  uint64_t head = src->head.load(std::memory_order_acquire);
+  while (head == tail) {
+    src->head.wait(head, std::memory_order_acquire);
+    head = src->head.load(std::memory_order_acquire);
+  }
+
+  *chunk = src->ring[tail % BZ_RING_CHUNKS];
+  *len = src->ring_len[tail % BZ_RING_CHUNKS];
+  if (*len == 0) {
+    // Stay parked on the end marker
+    src->started = false;
+    return 0;
+  }
+  return 1;
+}
+
+//------------------------------------//
+//           Parallel Mode            //
+//------------------------------------//
+
+static inline int get_bit(const uint8_t *in, uint64_t pos) {
+  return (in[pos >> 3] >> (7 - (pos & 7))) & 1;
+}
+
+// Finds every block, using the markers as boundaries. A marker pattern
+// can in theory show up inside compressed data; the block it splits then
+// fails its CRC and the source falls back to serial mode.
+//
+static void find_blocks(bz_source *src) {
+  const uint8_t *in = src->in;
+  const uint64_t mask = (1ull << 48) - 1;
+  uint64_t w = 0;
+  bool open = false;
+
+  for (size_t i = 0; i < src->in_len; i++) {
+    w = (w << 8) | in[i];
+    if (i < 6)
+      continue;
+    for (int s = 7; s >= 0; s--) {
+      uint64_t v = (w >> s) & mask;
+      if (v != BZ_BLOCK_MAGIC && v != BZ_EOS_MAGIC)
+        continue;
+      uint64_t pos = 8 * (uint64_t)(i + 1) - s - 48;
+      if (open)
+        src->blocks.back().end_bit = pos;
+      open = (v == BZ_BLOCK_MAGIC);
+      if (open) {
+        bz_block b = {pos, 8 * (uint64_t)src->in_len, NULL, 0, 0};
+        src->blocks.push_back(b);
+      }
+    }
+  }
+}
+
+// Small MSB-first bit writer for the end of the rebuilt stream
+typedef struct {
+  uint8_t *p;
+  uint32_t acc;
+  int n;
+} bit_writer;
+
+static void put_bits(bit_writer *bw, uint64_t v, int count) {
+  while (count-- > 0) {
+    bw->acc = (bw->acc << 1) | ((v >> count) & 1);
+    if (++bw->n == 8) {
+      *bw->p++ = (uint8_t)bw->acc;
+      bw->acc = 0;
+      bw->n = 0;
+    }
+  }
+}
+
+// Wraps block 'b' into a standalone single block stream: header, the
+// block bits, end of stream marker and a stream CRC, which for a single
+// block is just the block's own CRC. Then decodes it.
+//
+// Returns the new state of the block
+//
+static int decode_block(const bz_source *src, bz_block *b) {
+  const uint8_t *in = src->in;
+  uint64_t nbits = b->end_bit - b->start_bit;
+  size_t in_len = 4 + (nbits + 48 + 32 + 7) / 8;
+  uint8_t *stream = (uint8_t *)malloc(in_len);
+
+  memcpy(stream, "BZh9", 4);
+  size_t whole = nbits / 8;
+  size_t first = b->start_bit >> 3;
+  int shift = b->start_bit & 7;
+  for (size_t j = 0; j < whole; j++) {
+    uint32_t hi = in[first + j];
+    uint32_t lo = first + j + 1 < src->in_len ? in[first + j + 1] : 0;
+    stream[4 + j] = (uint8_t)((hi << shift) | (lo >> (8 - shift)));
+  }
+
+  uint32_t crc = 0;
+  for (int k = 0; k < 32; k++)
+    crc = (crc << 1) | get_bit(in, b->start_bit + 48 + k);
+
+  bit_writer bw = {stream + 4 + whole, 0, 0};
+  for (uint64_t pos = b->start_bit + 8 * whole; pos < b->end_bit; pos++)
+    put_bits(&bw, get_bit(in, pos), 1);
+  put_bits(&bw, BZ_EOS_MAGIC, 48);
+  put_bits(&bw, crc, 32);
+  if (bw.n > 0)
+    put_bits(&bw, 0, 8 - bw.n);
+
+  bz_stream bz;
+  memset(&bz, 0, sizeof(bz));
+  size_t cap = BZ_CHUNK_SIZE;
+  uint8_t *out = (uint8_t *)malloc(cap);
+  int rc = BZ2_bzDecompressInit(&bz, 0, 0);
+  bz.next_in = (char *)stream;
+  bz.avail_in = (unsigned int)(bw.p - stream);
+  bz.next_out = (char *)out;
+  bz.avail_out = cap;
+
+  while (rc == BZ_OK) {
+    rc = BZ2_bzDecompress(&bz);
+    if (rc == BZ_OK && bz.avail_out == 0) {
+      size_t used = cap;
+      cap *= 2;
+      out = (uint8_t *)realloc(out, cap);
+      bz.next_out = (char *)out + used;
+      bz.avail_out = cap - used;
+    } else if (rc == BZ_OK && bz.avail_in == 0) {
+      rc = BZ_UNEXPECTED_EOF;
+    }
+  }
+  BZ2_bzDecompressEnd(&bz);
+  free(stream);
+
+  b->out = out;
+  b->out_len = cap - bz.avail_out;
+  return rc == BZ_STREAM_END ? 1 : -1;
+}
+
+static void decode_worker(bz_source *src) {
+  std::unique_lock<std::mutex> guard(src->lock);
+  while (true) {
+    src->room.wait(guard, [src] {
+      return src->stop || src->claimed == src->blocks.size() ||
+             src->claimed < src->consumed + src->window;
+    });
+    if (src->stop || src->claimed == src->blocks.size())
+      return;
+
+    bz_block *b = &src->blocks[src->claimed++];
+    guard.unlock();
+    int state = decode_block(src, b);
+    guard.lock();
+    b->state = state;
+    src->decoded.notify_all();
+  }
+}
+
+// Appends 'len' bytes to the spill buffer
+//
+static void spill_append(bz_source *src, const uint8_t *data, size_t len) {
+  if (src->spill_len + len > src->spill_cap) {
+    src->spill_cap = 2 * (src->spill_len + len);
+    src->spill = (uint8_t *)realloc(src->spill, src->spill_cap);
+  }
+  memcpy(src->spill + src->spill_len, data, len);
+  src->spill_len += len;
+}
+
+// Stops the workers and carries on with the serial decoder, skipping the
+// output already handed to the consumer
+//
+static void fall_back_to_serial(bz_source *src) {
+  {
+    std::lock_guard<std::mutex> guard(src->lock);
+    src->stop = true;
+  }
+  src->room.notify_all();
+  for (std::thread &t : src->workers)
+    t.join();
+  src->workers.clear();
+  for (bz_block &b : src->blocks)
+    free(b.out);
+  src->blocks.clear();
+  free(src->chunk);
+  free(src->spill);
+
+  src->parallel = false;
+  src->stop = false;
+  src->discard = src->handed;
+  for (int i = 0; i < BZ_RING_CHUNKS; i++)
+    src->ring[i] = (uint8_t *)malloc(BZ_CHUNK_SIZE + TRACE_PAD);
+  src->spill = (uint8_t *)malloc(BZ_CHUNK_SIZE);
+  src->producer = std::thread(produce, src);
+}
+
+static int next_parallel(bz_source *src, const uint8_t **chunk,
+                         size_t *len) {
+  while (true) {
+    size_t n = src->blocks.size();
+    bz_block *b = NULL;
+    if (src->consumed < n && !src->error) {
+      std::unique_lock<std::mutex> guard(src->lock);
+      b = &src->blocks[src->consumed];
+      src->decoded.wait(guard, [b] { return b->state != 0; });
+      src->consumed++;
+      src->room.notify_all();
+    }
+
+    if (b != NULL && b->state < 0) {
+      // Most likely a marker pattern inside compressed data rather than
+      // a corrupt file; the serial decoder tells the two apart
+      fall_back_to_serial(src);
+      return next_serial(src, chunk, len);
+    }
+
+    int last = src->consumed == n || src->error;
+    if (b != NULL) {
+      spill_append(src, b->out, b->out_len);
+      free(b->out);
+      b->out = NULL;
+    }
+    if (last && src->spill_len == 0)
+      return 0;
+
+    // Hand out everything up to the last record boundary
+    size_t cut = record_cut(src, src->spill, src->spill_len, last);
+    if (cut == 0)
+      continue;
+
+    if (cut + TRACE_PAD > src->chunk_cap) {
+      src->chunk_cap = cut + TRACE_PAD;
+      src->chunk = (uint8_t *)realloc(src->chunk, src->chunk_cap);
+    }
+    memcpy(src->chunk, src->spill, cut);
+    src->chunk[cut] = '\0';
+    memmove(src->spill, src->spill + cut, src->spill_len - cut);
+    src->spill_len -= cut;
+
+    src->handed += cut;
+    *chunk = src->chunk;
+    *len = cut;
+    return 1;
+  }
+}
+
+//------------------------------------//
+//            Source API              //
+//------------------------------------//
+
+bz_source *bz_source_start(const uint8_t *data, size_t len) {
+  bz_source *src = new bz_source();
+  src->in = data;
+  src->in_len = len;
+  src->binary = -1;
+  src->head = 0;
+  src->tail = 0;
+  src->stop = false;
+
+  unsigned threads = trace_decode_threads > 0
+                         ? (unsigned)trace_decode_threads
+                         : std::thread::hardware_concurrency();
+  if (threads > 1)
+    find_blocks(src);
+
+  if (src->blocks.size() > 1) {
+    src->parallel = true;
+    src->window = BZ_BLOCKS_PER_WORKER * threads;
+    for (unsigned i = 0; i < threads; i++)
+      src->workers.push_back(std::thread(decode_worker, src));
+  } else {
+    src->blocks.clear();
+    for (int i = 0; i < BZ_RING_CHUNKS; i++)
+      src->ring[i] = (uint8_t *)malloc(BZ_CHUNK_SIZE + TRACE_PAD);
+    src->spill = (uint8_t *)malloc(BZ_CHUNK_SIZE);
+    src->producer = std::thread(produce, src);
+  }
+  return src;
+}
+
+int bz_source_next(bz_source *src, const uint8_t **chunk, size_t *len) {
+  if (src->parallel)
+    return next_parallel(src, chunk, len);
+  return next_serial(src, chunk, len);
+}
+
+int bz_source_error(bz_source *src) {
+  return src->error;
+}
+
+void bz_source_stop(bz_source *src) {
+  if (src->parallel) {
+    {
+      std::lock_guard<std::mutex> guard(src->lock);
+      src->stop = true;
+    }
+    src->room.notify_all();
+    for (std::thread &t : src->workers)
+      t.join();
+    for (bz_block &b : src->blocks)
+      free(b.out);
+    free(src->chunk);
+  } else {
+    src->stop.store(true);
+    // Wake the producer if it is waiting for room
+    src->tail.fetch_add(BZ_RING_CHUNKS, std::memory_order_release);
+    src->tail.notify_one();
+    src->producer.join();
+    for (int i = 0; i < BZ_RING_CHUNKS; i++)
+      free(src->ring[i]);
+  }
+
+  free(src->spill);
+  delete src;
+}
@@ -0,0 +1,44 @@
+//========================================================//
+//  bzsource.h                                            //
+//  Header file for the bzip2 trace source                //
+//                                                        //
+//  Decompresses a .bz2 trace on a producer thread into a //
+//  single-producer/single-consumer ring of chunks that   //
+//  the trace reader parses while decoding continues      //
+//========================================================//
+
+#ifndef BZSOURCE_H
+#define BZSOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct bz_source bz_source;
+
+// Returns True if 'data' starts like a bzip2 stream
+//
+int bz_is_bzip2(const uint8_t *data, size_t len);
+
+// Starts decompressing the bzip2 data in 'data'. The buffer must stay
+// valid until bz_source_stop.
+//
+bz_source *bz_source_start(const uint8_t *data, size_t len);
+
+// Hands out the next chunk of decompressed trace, releasing the previous
+// one. Chunks always end on a record boundary (a newline for text, a whole
+// record for binary traces) and are followed by a NUL byte and TRACE_PAD
+// readable bytes.
+//
+// Returns False once the stream is exhausted
+//
+int bz_source_next(bz_source *src, const uint8_t **chunk, size_t *len);
+
+// Returns True if decompression stopped on corrupt input
+//
+int bz_source_error(bz_source *src);
+
+// Stops the producer thread and frees the source
+//
+void bz_source_stop(bz_source *src);
+
+#endif
@@ -0,0 +1,175 @@
+//========================================================//
+//  checkpoint.cpp                                        //
+//  Source file for predictor checkpoints                 //
+//========================================================//
+#include "checkpoint.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Header fields are little endian, like the binary trace formats
+static int write_u64(FILE *out, uint64_t v) {
+  uint8_t bytes[8];
+  for (int i = 0; i < 8; i++)
+    bytes[i] = (uint8_t)(v >> (8 * i));
+  return fwrite(bytes, sizeof(bytes), 1, out) == 1;
+}
+
+static int read_u64(FILE *in, uint64_t *v) {
+  uint8_t bytes[8];
+  if (fread(bytes, sizeof(bytes), 1, in) != 1)
+    return 0;
+  *v = 0;
+  for (int i = 0; i < 8; i++)
+    *v |= (uint64_t)bytes[i] << (8 * i);
+  return 1;
+}
+
+int checkpoint_save(const char *path, const predictor_info *type,
+                    const Predictor *predictor, uint64_t index) {
+  // Serialize the state first, so its size can go in the header
+  char *state = NULL;
+  size_t size = 0;
+  FILE *buffer = open_memstream(&state, &size);
+  if (buffer == NULL)
+    return 0;
+  int ok = predictor->save_state(buffer);
+  ok = fclose(buffer) == 0 && ok;
+
+  FILE *out = ok ? fopen(path, "wb") : NULL;
+  if (out != NULL) {
+    uint32_t len = (uint32_t)strlen(type->name);
+    uint8_t len_bytes[4] = {(uint8_t)len, (uint8_t)(len >> 8),
+                            (uint8_t)(len >> 16), (uint8_t)(len >> 24)};
+    ok = fwrite(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN, 1, out) == 1 &&
+         write_u64(out, index) && fwrite(len_bytes, 4, 1, out) == 1 &&
+         fwrite(type->name, len, 1, out) == 1 && write_u64(out, size) &&
+         (size == 0 || fwrite(state, size, 1, out) == 1);
+    ok = fclose(out) == 0 && ok;
+  } else {
+    ok = 0;
+  }
+
+  free(state);
+  return ok;
+}
+
+// Reads the header up to and including the type name, leaving 'in' at the
+// state size
+//
+// Returns the (malloc'd) type name, or NULL if 'in' is not a checkpoint
+//
+static char *read_header(FILE *in, uint64_t *index) {
+  char magic[CHECKPOINT_MAGIC_LEN];
+  uint8_t len_bytes[4];
+  if (fread(magic, sizeof(magic), 1, in) != 1 ||
+      memcmp(magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN) ||
+      !read_u64(in, index) || fread(len_bytes, 4, 1, in) != 1)
+    return NULL;
+
+  uint32_t len = len_bytes[0] | len_bytes[1] << 8 | len_bytes[2] << 16 |
+                 (uint32_t)len_bytes[3] << 24;
+  if (len > 4096)
+    return NULL;
+  char *name = (char *)calloc(len + 1, 1);
+  if (fread(name, 1, len, in) != len) {
+    free(name);
+    return NULL;
+  }
+  return name;
+}
+
+int checkpoint_index(const char *path, uint64_t *index) {
+  FILE *in = fopen(path, "rb");
+  if (in == NULL)
+    return 0;
+  char *name = read_header(in, index);
+  fclose(in);
+  free(name);
+  return name != NULL;
+}
+
+int checkpoint_load(const char *path, const predictor_info *type,
+                    Predictor *predictor, uint64_t *index) {
+  FILE *in = fopen(path, "rb");
+  if (in == NULL) {
+    fprintf(stderr, "Unable to read checkpoint %s\n", path);
+    return 0;
+  }
+
+  char *name = read_header(in, index);
+  uint64_t size;
+  if (name == NULL || !read_u64(in, &size)) {
+    fprintf(stderr, "%s is not a predictor checkpoint\n", path);
+    free(name);
+    fclose(in);
+    return 0;
+  }
+  if (strcmp(name, type->name)) {
+    fprintf(stderr, "%s holds a %s predictor, not %s\n", path, name,
+            type->name);
+    free(name);
+    fclose(in);
+    return 0;
+  }
+  free(name);
+
+  char *state = (char *)malloc(size ? size : 1);
+  int ok = state != NULL && fread(state, 1, size, in) == size;
+  fclose(in);
+
+  // The state must be exactly what this build of the type reads back
+  if (ok) {
+    FILE *buffer = fmemopen(state, size ? size : 1, "rb");
+    ok = buffer != NULL && predictor->load_state(buffer) &&
+         (uint64_t)ftell(buffer) == size;
+    if (buffer != NULL)
+      fclose(buffer);
+  }
+  if (!ok)
+    fprintf(stderr, "%s does not match this build of %s\n", path,
+            type->name);
+
+  free(state);
+  return ok;
+}
+
+int simulate_checkpointed(const predictor_info *type, Predictor *predictor,
+                          const branch_trace &trace, uint64_t first,
+                          uint64_t warmup, const sim_output *output,
+                          const char *save_path, uint64_t save_at,
+                          sim_stats *stats) {
+  if (save_path == NULL) {
+    *stats = type->run(predictor, trace, warmup, output);
+    return 1;
+  }
+  if (save_at < first || save_at > first + trace.count) {
+    fprintf(stderr, "Record %llu is outside the simulated records\n",
+            (unsigned long long)save_at);
+    return 0;
+  }
+
+  // Run up to the checkpoint, save, then run the rest over a view of the
+  // remaining records
+  uint64_t split = save_at - first;
+  branch_trace head = trace_slice(trace, 0, split);
+  branch_trace tail = trace_slice(trace, split, trace.count - split);
+
+  sim_stats before = type->run(predictor, head, warmup, output);
+  if (!checkpoint_save(save_path, type, predictor, save_at)) {
+    fprintf(stderr, "Unable to write checkpoint %s\n", save_path);
+    return 0;
+  }
+  sim_output tail_output;
+  if (output != NULL) {
+    tail_output = *output;
+    tail_output.first += split;
+  }
+  sim_stats after =
+      type->run(predictor, tail, warmup > split ? warmup - split : 0,
+                output != NULL ? &tail_output : NULL);
+
+  stats->num_branches = before.num_branches + after.num_branches;
+  stats->mispredictions = before.mispredictions + after.mispredictions;
+  return 1;
+}
@@ -0,0 +1,60 @@
+//========================================================//
+//  checkpoint.h                                          //
+//  Header file for predictor checkpoints                 //
+//                                                        //
+//  A checkpoint holds the complete state of one          //
+//  predictor at a record of the trace, so a warmed up    //
+//  predictor can be resumed there without replaying      //
+//  the prefix                                            //
+//========================================================//
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "simulate.h"
+#include <stdint.h>
+
+// A checkpoint starts with the 8 byte magic below, then the u64 index of
+// the first record not yet seen by the predictor, the u32 length of the
+// registered type name, the name, the u64 size of the state and the state
+// as written by Predictor::save_state
+#define CHECKPOINT_MAGIC "BPSTATE1"
+#define CHECKPOINT_MAGIC_LEN 8
+
+// Saves 'predictor', an instance of 'type' that has seen the first 'index'
+// records of the trace, to 'path'
+//
+// Returns True if Successful
+//
+int checkpoint_save(const char *path, const predictor_info *type,
+                    const Predictor *predictor, uint64_t index);
+
+// Restores the checkpoint at 'path' into 'predictor', an instance of
+// 'type', and sets '*index' to the record to resume from
+//
+// Returns True if Successful; fails with a message on stderr if the file
+// is not a checkpoint of 'type'
+//
+int checkpoint_load(const char *path, const predictor_info *type,
+                    Predictor *predictor, uint64_t *index);
+
+// Reads just the resume index of the checkpoint at 'path'
+//
+// Returns True if Successful
+//
+int checkpoint_index(const char *path, uint64_t *index);
+
+// Runs 'predictor' over 'trace', whose first record is record 'first' of
+// the whole trace, like predictor_info::run. If 'save_path' is not NULL
+// the state reached just before record 'save_at', which must fall in or
+// just past the end of the trace, is saved there.
+//
+// Returns True if Successful, with the counts in '*stats'
+//
+int simulate_checkpointed(const predictor_info *type, Predictor *predictor,
+                          const branch_trace &trace, uint64_t first,
+                          uint64_t warmup, const sim_output *output,
+                          const char *save_path, uint64_t save_at,
+                          sim_stats *stats);
+
+#endif
@@ -7,26 +7,147 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include "alias.h"
+#include "checkpoint.h"
 #include "predictor.h"
+#include "predstream.h"
+#include "profile.h"
+#include "runner.h"
+#include "simulate.h"
+#include "sweep.h"
+#include "trace.h"
+#include "tracecache.h"
 
-FILE *stream;
-char *buf = NULL;
-size_t len = 0;
+const char *trace_path;
+trace_reader *reader;
+branch_trace trace;
+
+// Traces given on the command line; with more than one they are all
+// simulated together by the runner
+const char **tracePaths;
+int numTraces;
+int jobs; // Runner threads, 0 for one per core
+
+// Parameter sweep: grid families to run and the ranges of the grid kept
+const char **sweepFamilies;
+int numSweepFamilies;
+int ghistRange[2];   // Lowest and highest global history bits
+int chooserRange[2]; // Lowest and highest chooser bits
+const char *csvPath; // Sweep results, stdout if NULL
+
+// Predictor checkpoints
+const char *saveStatePath; // Save the predictor here, NULL for none
+uint64_t saveAt;           // Record to save at, UINT64_MAX for the end
+const char *loadStatePath; // Resume the predictor from here, NULL for none
+int skipGiven;             // --skip was given, so it overrides the checkpoint
+
+// Sharded simulation
+int shards;            // Intervals simulated in parallel, 1 to run in order
+uint64_t shardWarmup;  // Records each shard trains on before its interval
+int shardCheck;        // Also run in order and report the error
+
+// Packed prediction stream of the run, NULL for none
+const char *predictionsPath;
+// Log of the mispredicted branches of the run, NULL for none
+const char *mispredictLogPath;
+// Static branches listed in the profile of each type, 0 for no profile
+int profileTop;
+// Hottest table entries listed by the alias analysis, 0 for no analysis
+int aliasTop;
+
+// Predictor types to simulate, in the order they were given
+const predictor_info **bpTypes;
+int numTypes;
+
+// Window of the trace to simulate, in records
+uint64_t skip;   // Records passed over before anything else
+uint64_t warmup; // Records that train the predictor but are not counted
+uint64_t limit;  // Records counted after the warmup, 0 for all
 
 // Print out the Usage information to stderr
 //
 void usage()
 {
-  fprintf(stderr, "Usage: predictor <options> [<trace>]\n");
+  fprintf(stderr, "Usage: predictor <options> [<trace>...]\n");
   fprintf(stderr, "       bunzip2 -kc trace.bz2 | predictor <options>\n");
+  fprintf(stderr, " <trace> may be text or binary (see traceconv), and either\n"
+                  " may be bzip2 compressed. Several traces are simulated in\n"
+                  " parallel and summarized in one table\n");
   fprintf(stderr, " Options:\n");
   fprintf(stderr, " --help       Print this message\n");
   fprintf(stderr, " --verbose    Print predictions on stdout\n");
-  fprintf(stderr, " --<type>     Branch prediction scheme:\n");
-  fprintf(stderr, "    static\n"
-                  "    gshare\n"
-                  "    tournament\n"
-                  "    custom\n");
+  fprintf(stderr, " --predictions=<file>\n"
+                  "              Write predictions to file packed one bit each,\n"
+                  "              for comparing runs with preddiff\n");
+  fprintf(stderr, " --mispredict-log=<file>\n"
+                  "              Log each mispredicted branch to file in binary,\n"
+                  "              with the component that predicted it\n");
+  fprintf(stderr, " --profile[=<n>]\n"
+                  "              List the n branch PCs (default 20) with the most\n"
+                  "              mispredictions and their share of them\n");
+  fprintf(stderr, " --aliasing[=<n>]\n"
+                  "              Analyze sharing of table entries between branches\n"
+                  "              and list the n (default 10) most conflicting\n");
+  fprintf(stderr, " --skip=<n>   Start at record n, jumping straight there when\n"
+                  "              the trace format allows it\n");
+  fprintf(stderr, " --warmup=<n> Train on n records before counting any\n");
+  fprintf(stderr, " --limit=<n>  Count at most n records after the warmup\n");
+  fprintf(stderr, " --jobs=<n>   Simulate n traces at a time (0 = all cores)\n");
+  fprintf(stderr, " --save-state=<file>\n"
+                  "              Save the predictor state to file, after the\n"
+                  "              whole window or at --save-at\n");
+  fprintf(stderr, " --save-at=<n>\n"
+                  "              Save the state reached just before record n\n");
+  fprintf(stderr, " --load-state=<file>\n"
+                  "              Resume from a saved state, at the record it was\n"
+                  "              saved at unless --skip is given\n");
+  fprintf(stderr, " --shards=<k> Split the window into k intervals simulated in\n"
+                  "              parallel, each by a fresh predictor\n");
+  fprintf(stderr, " --shard-warmup=<n>\n"
+                  "              Train each shard on the n records before it\n"
+                  "              (default 1000000)\n");
+  fprintf(stderr, " --shard-check\n"
+                  "              Also simulate in order and report the error\n");
+  fprintf(stderr, " --no-simd    Use the scalar trace parser\n");
+  fprintf(stderr, " --decode-threads=<n>\n"
+                  "              Threads for decoding .bz2 traces (0 = all cores)\n");
+  fprintf(stderr, " --no-cache   Do not cache decoded .bz2 traces\n");
+  fprintf(stderr, " --cache-dir=<dir>\n"
+                  "              Decoded trace cache (default $BP_TRACE_CACHE\n"
+                  "              or ~/.cache/bp_traces)\n");
+  fprintf(stderr, " --cache-size=<MB>\n"
+                  "              Evict least recently used traces beyond this\n");
+  fprintf(stderr, " --sweep=<family>\n"
+                  "              Simulate every configuration of a family that fits\n"
+                  "              the budget and write them as CSV; may be repeated:\n"
+                  "                gshare      ghist 8..15\n"
+                  "                tournament  ghist 10..14 x chooser 10..14\n"
+                  "                custom      ghist 10..14 x chooser 10..14\n");
+  fprintf(stderr, " --ghist=<lo>[..<hi>]\n"
+                  "              Only sweep these global history widths\n");
+  fprintf(stderr, " --chooser=<lo>[..<hi>]\n"
+                  "              Only sweep these chooser widths\n");
+  fprintf(stderr, " --csv=<file> Write the sweep to file rather than stdout\n");
+  fprintf(stderr, " --<type>     Branch prediction scheme, may be given several\n"
+                  "              times to compare schemes on one trace; a\n"
+                  "              :<param> suffix is accepted and ignored:\n");
+  for (int i = 0; i < num_predictors(); i++)
+  {
+    fprintf(stderr, "    %s\n", predictor_at(i)->name);
+  }
+}
+
+// Parse "<lo>" or "<lo>..<hi>" into range
+//
+// Returns True if Successful
+//
+int parse_range(const char *arg, int range[2])
+{
+  int n = sscanf(arg, "%d..%d", &range[0], &range[1]);
+  if (n == 1)
+    range[1] = range[0];
+  return n >= 1 && range[0] <= range[1];
 }
 
 // Process an option and update the predictor
@@ -36,25 +157,139 @@ void usage()
 //
 int handle_option(char *arg)
 {
-  if (!strcmp(arg, "--static"))
+  // Add a registered predictor type, once. As in the original lab, a
+  // parameter after the name (e.g. --gshare:13) is accepted and ignored
+  char name[64];
+  size_t len = strcspn(arg + 2, ":");
+  const predictor_info *type = NULL;
+  if (len < sizeof(name))
   {
-    bpType = STATIC;
+    memcpy(name, arg + 2, len);
+    name[len] = '\0';
+    type = find_predictor(name);
   }
-  else if (!strncmp(arg, "--gshare", 8))
+  if (type != NULL)
   {
-    bpType = GSHARE;
+    int i = 0;
+    while (i < numTypes && bpTypes[i] != type)
+      i++;
+    if (i == numTypes)
+      bpTypes[numTypes++] = type;
+    return 1;
   }
-  else if (!strncmp(arg, "--tournament", 12))
+
+  if (!strcmp(arg, "--verbose"))
   {
-    bpType = TOURNAMENT;
+    verbose = 1;
   }
-  else if (!strncmp(arg, "--custom", 8))
+  else if (!strncmp(arg, "--predictions=", 14))
   {
-    bpType = CUSTOM;
+    predictionsPath = arg + 14;
   }
-  else if (!strcmp(arg, "--verbose"))
+  else if (!strncmp(arg, "--mispredict-log=", 17))
   {
-    verbose = 1;
+    mispredictLogPath = arg + 17;
+  }
+  else if (!strcmp(arg, "--profile"))
+  {
+    profileTop = 20;
+  }
+  else if (!strncmp(arg, "--profile=", 10))
+  {
+    profileTop = atoi(arg + 10);
+    if (profileTop < 1)
+      return 0;
+  }
+  else if (!strcmp(arg, "--aliasing"))
+  {
+    aliasTop = 10;
+  }
+  else if (!strncmp(arg, "--aliasing=", 11))
+  {
+    aliasTop = atoi(arg + 11);
+    if (aliasTop < 1)
+      return 0;
+  }
+  else if (!strncmp(arg, "--skip=", 7))
+  {
+    skip = strtoull(arg + 7, NULL, 10);
+    skipGiven = 1;
+  }
+  else if (!strncmp(arg, "--warmup=", 9))
+  {
+    warmup = strtoull(arg + 9, NULL, 10);
+  }
+  else if (!strncmp(arg, "--limit=", 8))
+  {
+    limit = strtoull(arg + 8, NULL, 10);
+  }
+  else if (!strncmp(arg, "--sweep=", 8))
+  {
+    if (!sweep_has_family(arg + 8))
+      return 0;
+    sweepFamilies[numSweepFamilies++] = arg + 8;
+  }
+  else if (!strncmp(arg, "--ghist=", 8))
+  {
+    return parse_range(arg + 8, ghistRange);
+  }
+  else if (!strncmp(arg, "--chooser=", 10))
+  {
+    return parse_range(arg + 10, chooserRange);
+  }
+  else if (!strncmp(arg, "--csv=", 6))
+  {
+    csvPath = arg + 6;
+  }
+  else if (!strncmp(arg, "--save-state=", 13))
+  {
+    saveStatePath = arg + 13;
+  }
+  else if (!strncmp(arg, "--save-at=", 10))
+  {
+    saveAt = strtoull(arg + 10, NULL, 10);
+  }
+  else if (!strncmp(arg, "--load-state=", 13))
+  {
+    loadStatePath = arg + 13;
+  }
+  else if (!strncmp(arg, "--shards=", 9))
+  {
+    shards = atoi(arg + 9);
+    if (shards < 1)
+      return 0;
+  }
+  else if (!strncmp(arg, "--shard-warmup=", 15))
+  {
+    shardWarmup = strtoull(arg + 15, NULL, 10);
+  }
+  else if (!strcmp(arg, "--shard-check"))
+  {
+    shardCheck = 1;
+  }
+  else if (!strncmp(arg, "--jobs=", 7))
+  {
+    jobs = atoi(arg + 7);
+  }
+  else if (!strcmp(arg, "--no-simd"))
+  {
+    trace_use_simd = 0;
+  }
+  else if (!strncmp(arg, "--decode-threads=", 17))
+  {
+    trace_decode_threads = atoi(arg + 17);
+  }
+  else if (!strcmp(arg, "--no-cache"))
+  {
+    trace_cache_enabled = 0;
+  }
+  else if (!strncmp(arg, "--cache-dir=", 12))
+  {
+    trace_cache_dir = arg + 12;
+  }
+  else if (!strncmp(arg, "--cache-size=", 13))
+  {
+    trace_cache_limit = strtoull(arg + 13, NULL, 10) << 20;
   }
   else
   {
@@ -64,29 +299,163 @@ int handle_option(char *arg)
   return 1;
 }
 
-// Reads a line from the input stream and extracts the
-// PC and Outcome of a branch
+// Returns True if 'config' is in a selected family and range of the grid
+//
+int sweep_selected(const sweep_config *config)
+{
+  int selected = 0;
+  for (int f = 0; f < numSweepFamilies; f++)
+  {
+    if (!strcmp(config->family, sweepFamilies[f]))
+      selected = 1;
+  }
+  if (!selected || config->ghist < ghistRange[0] || config->ghist > ghistRange[1])
+    return 0;
+  // Gshare has no chooser, so the chooser range does not apply to it
+  return !config->chooser || (config->chooser >= chooserRange[0] && config->chooser <= chooserRange[1]);
+}
+
+// Simulate the selected part of the sweep grid over every trace and
+// write it out as CSV
 //
 // Returns True if Successful
 //
-int read_branch(uint32_t *pc, uint32_t *target, uint32_t *outcome, uint32_t *condition, uint32_t *call, uint32_t *ret, uint32_t *direct)
+int sweep()
 {
-  if (getline(&buf, &len, stream) == -1)
+  const sweep_config **configs = (const sweep_config **)malloc(num_sweep_configs() * sizeof(*configs));
+  int numConfigs = 0;
+  for (int i = 0; i < num_sweep_configs(); i++)
   {
+    if (sweep_selected(sweep_config_at(i)))
+      configs[numConfigs++] = sweep_config_at(i);
+  }
+  int overBudget = 0;
+  for (int i = 0; i < num_sweep_over_budget(); i++)
+  {
+    overBudget += sweep_selected(sweep_over_budget_at(i));
+  }
+
+  if (numConfigs == 0)
+  {
+    fprintf(stderr, "No configuration of the grid is in range\n");
+    free(configs);
+    return 0;
+  }
+
+  FILE *out = csvPath ? fopen(csvPath, "w") : stdout;
+  if (out == NULL)
+  {
+    fprintf(stderr, "Unable to write %s\n", csvPath);
+    free(configs);
     return 0;
   }
 
-  sscanf(buf, "0x%x\t0x%x\t%d\t%d\t%d\t%d\t%d\n", pc, target, outcome, condition, call, ret, direct);
+  // Every (configuration, trace) pair is a job of its own
+  const predictor_info **types = (const predictor_info **)malloc(numConfigs * sizeof(*types));
+  for (int c = 0; c < numConfigs; c++)
+  {
+    types[c] = &configs[c]->info;
+  }
+  int paths = numTraces ? numTraces : 1;
+  sim_window window = {skip, warmup, limit};
+  trace_result *results = (trace_result *)malloc(paths * sizeof(trace_result));
+  run_summary summary;
+  run_traces(numTraces ? tracePaths : &trace_path, paths, types, numConfigs, window, jobs, results, &summary);
+  print_sweep_csv(out, configs, numConfigs, results, paths);
 
-  return 1;
+  int failed = 0;
+  for (int i = 0; i < paths; i++)
+  {
+    if (results[i].error != NULL)
+    {
+      fprintf(stderr, "%s: %s\n", trace_name(&results[i]), results[i].error);
+      failed = 1;
+    }
+  }
+
+  // The summary goes to stderr when stdout carries the CSV
+  FILE *report = csvPath ? stdout : stderr;
+  if (csvPath)
+  {
+    fclose(out);
+  }
+  fprintf(report, "Configurations:  %10d (%d of the grid over budget)\n", numConfigs, overBudget);
+  for (int f = 0; f < numSweepFamilies; f++)
+  {
+    // Report the best configuration of each family, by geomean over the traces
+    int best = -1;
+    double bestRate = 0;
+    for (int c = 0; c < numConfigs; c++)
+    {
+      if (strcmp(configs[c]->family, sweepFamilies[f]))
+        continue;
+      double rate = geomean_rate(results, paths, c);
+      if (best < 0 || rate < bestRate)
+      {
+        best = c;
+        bestRate = rate;
+      }
+    }
+    if (best >= 0)
+    {
+      char params[32];
+      int n = snprintf(params, sizeof(params), "ghist %d", configs[best]->ghist);
+      if (configs[best]->chooser)
+        snprintf(params + n, sizeof(params) - n, " chooser %d", configs[best]->chooser);
+      fprintf(report, "Best %-10s %-20s %7.3f\n", configs[best]->family, params, bestRate);
+    }
+  }
+  fprintf(report, "%d jobs on %d threads in %.2f s, %.0f%% core utilization\n", summary.jobs, summary.threads,
+          summary.wall_seconds, 100 * summary.busy_seconds / (summary.wall_seconds * summary.threads));
+
+  free_results(results, paths);
+  free(results);
+  free(types);
+  free(configs);
+  return !failed;
+}
+
+// Start a mispredict log naming the components of 'predictor'
+//
+// Returns NULL if the file cannot be created
+//
+miss_writer *open_mispredict_log(const char *path, const Predictor *predictor)
+{
+  const char *components[2];
+  int numComponents = 0;
+  while (numComponents < 2 && predictor->component(numComponents) != NULL)
+  {
+    components[numComponents] = predictor->component(numComponents);
+    numComponents++;
+  }
+  return miss_writer_open(path, components, numComponents);
 }
 
 int main(int argc, char *argv[])
 {
   // Set defaults
-  stream = stdin;
-  bpType = STATIC;
+  trace_path = NULL;
+  bpTypes = (const predictor_info **)malloc(num_predictors() * sizeof(*bpTypes));
+  numTypes = 0;
+  tracePaths = (const char **)malloc(argc * sizeof(*tracePaths));
+  numTraces = 0;
+  jobs = 0;
+  sweepFamilies = (const char **)malloc(argc * sizeof(*sweepFamilies));
+  numSweepFamilies = 0;
+  ghistRange[0] = chooserRange[0] = 0;
+  ghistRange[1] = chooserRange[1] = 64;
+  csvPath = NULL;
+  saveStatePath = loadStatePath = NULL;
+  saveAt = UINT64_MAX;
+  skipGiven = 0;
+  shards = 1;
+  shardWarmup = 1000000;
+  shardCheck = 0;
   verbose = 0;
+  predictionsPath = NULL;
+  mispredictLogPath = NULL;
+  profileTop = 0;
+  aliasTop = 0;
 
   // Process cmdline Arguments
   for (int i = 1; i < argc; ++i)
@@ -108,53 +477,265 @@ int main(int argc, char *argv[])
     else
     {
       // Use as input file
-      stream = fopen(argv[i], "r");
+      tracePaths[numTraces++] = argv[i];
     }
   }
 
-  // Initialize the predictor
-  init_predictor();
+  if (numTypes == 0)
+  {
+    bpTypes[numTypes++] = find_predictor("static");
+  }
+  if (numTypes > 1 && verbose)
+  {
+    fprintf(stderr, "--verbose takes a single predictor type\n");
+    exit(1);
+  }
+  if ((predictionsPath || mispredictLogPath) && (numTypes > 1 || numTraces > 1 || numSweepFamilies > 0 || shards > 1))
+  {
+    fprintf(stderr, "--predictions and --mispredict-log take a single predictor type and trace, without --shards\n");
+    exit(1);
+  }
+  if (profileTop && (numTraces > 1 || numSweepFamilies > 0 || shards > 1))
+  {
+    fprintf(stderr, "--profile takes a single trace, without --shards\n");
+    exit(1);
+  }
+  if (aliasTop && (numTraces > 1 || numSweepFamilies > 0 || shards > 1 || saveStatePath || loadStatePath))
+  {
+    fprintf(stderr, "--aliasing takes a single trace, without --shards or checkpoints\n");
+    exit(1);
+  }
+
+  trace_path = numTraces ? tracePaths[0] : NULL;
+
+  if ((saveStatePath || loadStatePath) && (numTypes > 1 || numTraces > 1 || numSweepFamilies > 0))
+  {
+    fprintf(stderr, "Checkpoints take a single predictor type and trace\n");
+    exit(1);
+  }
+  if (shards > 1 && (verbose || saveStatePath || loadStatePath || numTraces > 1 || numSweepFamilies > 0))
+  {
+    fprintf(stderr, "--shards takes a single trace, without --verbose or checkpoints\n");
+    exit(1);
+  }
 
-  uint32_t num_branches = 0;
-  uint32_t mispredictions = 0;
-  uint32_t pc = 0;
-  uint32_t target = 0;
-  uint32_t outcome = NOTTAKEN;
-  uint32_t condition = 0;
-  uint32_t call = 0;
-  uint32_t ret = 0;
-  uint32_t direct = 0;
+  if (numSweepFamilies > 0)
+  {
+    if (verbose)
+    {
+      fprintf(stderr, "--verbose does not apply to --sweep\n");
+      exit(1);
+    }
+    int failed = !sweep();
+    free(tracePaths);
+    free(sweepFamilies);
+    free(bpTypes);
+    return failed;
+  }
 
-  // Reach each branch from the trace
-  while (read_branch(&pc, &target, &outcome, &condition, &call, &ret, &direct))
+  if (numTraces > 1)
   {
-    if (condition == 1)
+    if (verbose)
     {
-      num_branches++;
-      // Make a prediction and compare with actual outcome
-      uint32_t prediction = make_prediction(pc, target, direct);
-      if (prediction != outcome)
-      {
-        mispredictions++;
-      }
-      if (verbose != 0)
+      fprintf(stderr, "--verbose takes a single trace\n");
+      exit(1);
+    }
+
+    sim_window window = {skip, warmup, limit};
+    trace_result *results = (trace_result *)malloc(numTraces * sizeof(trace_result));
+    run_summary summary;
+    run_traces(tracePaths, numTraces, bpTypes, numTypes, window, jobs, results, &summary);
+    print_results(stdout, results, numTraces, bpTypes, numTypes);
+    printf("\n");
+    print_job_times(stdout, results, numTraces, bpTypes, numTypes, &summary);
+
+    int failed = 0;
+    for (int i = 0; i < numTraces; i++)
+    {
+      if (results[i].error != NULL)
+        failed = 1;
+    }
+    free_results(results, numTraces);
+    free(results);
+    free(tracePaths);
+    free(sweepFamilies);
+    free(bpTypes);
+    return failed;
+  }
+
+  reader = trace_path ? trace_open_path(trace_path) : trace_open(stdin);
+  if (reader == NULL)
+  {
+    fprintf(stderr, "Unable to read trace\n");
+    exit(1);
+  }
+
+  // A resumed predictor continues from the record it was saved at
+  if (loadStatePath && !skipGiven && !checkpoint_index(loadStatePath, &skip))
+  {
+    fprintf(stderr, "%s is not a predictor checkpoint\n", loadStatePath);
+    exit(1);
+  }
+
+  // Load the simulated window up front
+  struct timespec start, stop;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (!trace_seek(reader, skip))
+  {
+    fprintf(stderr, "Trace has fewer than %llu records\n", (unsigned long long)skip);
+    exit(1);
+  }
+  uint64_t window = limit ? warmup + limit : UINT64_MAX;
+  if (!trace_load(reader, &trace, window))
+  {
+    fprintf(stderr, "Out of memory loading trace\n");
+    exit(1);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  double seconds = (stop.tv_sec - start.tv_sec) + 1e-9 * (stop.tv_nsec - start.tv_nsec);
+
+  sim_output output = {verbose, NULL, NULL, NULL, skip};
+  if (predictionsPath)
+  {
+    output.predictions = pred_writer_open(predictionsPath);
+    if (output.predictions == NULL)
+    {
+      fprintf(stderr, "Unable to write %s\n", predictionsPath);
+      exit(1);
+    }
+  }
+
+  // Each predictor walks the same in-memory trace in turn, or with shards
+  // each interval of it gets a predictor of its own, all at once
+  sim_stats *stats = (sim_stats *)malloc(numTypes * sizeof(sim_stats));
+  sim_stats *sequential = NULL;
+  pc_stats *profiles = NULL;
+  run_summary summary;
+  if (profileTop)
+  {
+    profiles = (pc_stats *)calloc((size_t)numTypes * trace.pc_count + 1, sizeof(pc_stats));
+  }
+  if (shards > 1)
+  {
+    if (shardCheck)
+      sequential = (sim_stats *)malloc(numTypes * sizeof(sim_stats));
+    run_shards(trace, bpTypes, numTypes, warmup, shards, shardWarmup, jobs, stats, sequential, &summary);
+  }
+  for (int t = 0; shards == 1 && t < numTypes; t++)
+  {
+    Predictor *predictor = bpTypes[t]->create();
+    uint64_t index;
+    if (loadStatePath && !checkpoint_load(loadStatePath, bpTypes[t], predictor, &index))
+    {
+      exit(1);
+    }
+    if (mispredictLogPath)
+    {
+      output.mispredicts = open_mispredict_log(mispredictLogPath, predictor);
+      if (output.mispredicts == NULL)
       {
-        printf("%d\n", prediction);
+        fprintf(stderr, "Unable to write %s\n", mispredictLogPath);
+        exit(1);
       }
     }
-    // Train the predictor
-    train_predictor(pc, target, outcome, condition, call, ret, direct);
+    if (profileTop)
+    {
+      output.profile = profiles + (size_t)t * trace.pc_count;
+    }
+    uint64_t at = saveAt == UINT64_MAX ? skip + trace.count : saveAt;
+    int logged = verbose || output.predictions || output.mispredicts || output.profile;
+    if (!simulate_checkpointed(bpTypes[t], predictor, trace, skip, warmup, logged ? &output : NULL, saveStatePath, at, &stats[t]))
+    {
+      exit(1);
+    }
+    delete predictor;
   }
+  if (output.predictions && !pred_writer_close(output.predictions))
+  {
+    fprintf(stderr, "Unable to write %s\n", predictionsPath);
+    exit(1);
+  }
+  if (output.mispredicts && !miss_writer_close(output.mispredicts))
+  {
+    fprintf(stderr, "Unable to write %s\n", mispredictLogPath);
+    exit(1);
+  }
+
+  // Print out the trace load throughput, which covers reading,
+  // decompressing and numbering the branch PCs as well as parsing
+  printf("Records:         %10llu\n", (unsigned long long)trace.count);
+  printf("Loaded/s:        %10.0f records (%s)\n", trace.count / seconds, trace_parser_name(reader));
+  printf("Branch PCs:      %10u\n", trace.pc_count);
 
   // Print out the mispredict statistics
-  printf("Branches:        %10d\n", num_branches);
-  printf("Incorrect:       %10d\n", mispredictions);
-  float mispredict_rate = 1000 * ((float)mispredictions / (float)num_branches);
-  printf("Misprediction Rate: %7.3f\n", mispredict_rate);
+  if (numTypes == 1)
+  {
+    printf("Branches:        %10d\n", stats[0].num_branches);
+    printf("Incorrect:       %10d\n", stats[0].mispredictions);
+    printf("Misprediction Rate: %7.3f\n", sim_rate(stats[0]));
+  }
+  else
+  {
+    printf("\n%-12s %10s %10s %19s\n", "Predictor", "Branches", "Incorrect", "Misprediction Rate");
+    for (int t = 0; t < numTypes; t++)
+    {
+      printf("%-12s %10d %10d %19.3f\n", bpTypes[t]->name, stats[t].num_branches, stats[t].mispredictions, sim_rate(stats[t]));
+    }
+  }
+
+  if (shards > 1)
+  {
+    uint64_t counted = trace.count > warmup ? trace.count - warmup : 0;
+    printf("\nShards:          %10d x %llu records, %llu warmup records each\n", shards,
+           (unsigned long long)(counted / shards), (unsigned long long)shardWarmup);
+    printf("Time:            %10.2f s on %d threads, %.0f%% core utilization\n", summary.wall_seconds,
+           summary.threads, 100 * summary.busy_seconds / (summary.wall_seconds * summary.threads));
+  }
+  if (sequential != NULL)
+  {
+    // Error of the sharded rate against simulating the trace in order
+    printf("\n%-12s %19s %21s\n", "Predictor", "Sequential Rate", "Sharding Error");
+    for (int t = 0; t < numTypes; t++)
+    {
+      double rate = sim_rate(sequential[t]);
+      double error = sim_rate(stats[t]) - rate;
+      printf("%-12s %19.3f %+11.3f (%+5.2f%%)\n", bpTypes[t]->name, rate, error, rate ? 100 * error / rate : 0);
+    }
+  }
+
+  for (int t = 0; profiles != NULL && t < numTypes; t++)
+  {
+    printf("\n");
+    if (numTypes > 1)
+      printf("%s: ", bpTypes[t]->name);
+    print_profile(stdout, profiles + (size_t)t * trace.pc_count, trace, profileTop);
+  }
+
+  // The analysis replays the window with a fresh predictor of each type
+  for (int t = 0; aliasTop && t < numTypes; t++)
+  {
+    Predictor *predictor = bpTypes[t]->create();
+    alias_report report = alias_analyze(predictor, trace, warmup);
+    printf("\n");
+    if (numTypes > 1)
+      printf("%s:\n", bpTypes[t]->name);
+    if (report.num_tables)
+      print_alias_report(stdout, &report, aliasTop);
+    else
+      printf("No tables to analyze\n");
+    alias_free(&report);
+    delete predictor;
+  }
 
   // Cleanup
-  fclose(stream);
-  free(buf);
+  free(profiles);
+  free(stats);
+  free(sequential);
+  free(tracePaths);
+  free(sweepFamilies);
+  free(bpTypes);
+  trace_free(&trace);
+  trace_close(reader);
 
   return 0;
 }
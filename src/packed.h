@@ -0,0 +1,176 @@
+//========================================================//
+//  packed.h                                              //
+//  Header file for bit packed predictor tables           //
+//                                                        //
+//  Packed counters and histories take exactly their      //
+//  modeled width, so a table uses as many bytes as the   //
+//  hardware it models and stays cache resident while     //
+//  simulating                                            //
+//========================================================//
+
+#ifndef PACKED_H
+#define PACKED_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <type_traits>
+
+// N fields of Bits bits each, back to back. A field is read or written
+// with one (possibly unaligned) access of the narrowest word that can hold
+// it at any bit offset, so the storage carries sizeof(word) - 1 spare bytes
+// for the last one. Widths dividing 8 never straddle bytes and use single
+// bytes, which also keeps neighbouring updates from stalling on store
+// forwarding.
+template <int Bits, uint32_t N> class PackedArray {
+  static_assert(Bits >= 1 && Bits <= 32);
+
+  typedef std::conditional_t<
+      8 % Bits == 0, uint8_t,
+      std::conditional_t<Bits <= 9, uint16_t,
+                         std::conditional_t<Bits <= 25, uint32_t, uint64_t>>>
+      word;
+
+public:
+  static constexpr uint32_t MAX = (uint32_t)((1ull << Bits) - 1);
+
+  // Sets every field to 'v'
+  //
+  void fill(uint32_t v) {
+    memset(data, 0, sizeof(data));
+    for (uint32_t i = 0; i < N; i++)
+      set(i, v);
+  }
+
+  uint32_t get(uint32_t i) const {
+    uint64_t bit = (uint64_t)i * Bits;
+    return (uint32_t)(load(bit >> 3) >> (bit & 7)) & MAX;
+  }
+
+  void set(uint32_t i, uint32_t v) {
+    uint64_t bit = (uint64_t)i * Bits;
+    uint64_t w = load(bit >> 3);
+    w &= ~((uint64_t)MAX << (bit & 7));
+    w |= (uint64_t)v << (bit & 7);
+    store(bit >> 3, w);
+  }
+
+  // Writes the raw fields to 'out' / reads them back from 'in'
+  //
+  // Returns True if Successful
+  //
+  int save(FILE *out) const {
+    return fwrite(data, sizeof(data), 1, out) == 1;
+  }
+  int restore(FILE *in) { return fread(data, sizeof(data), 1, in) == 1; }
+
+protected:
+  uint64_t load(uint64_t byte) const {
+    word w;
+    memcpy(&w, data + byte, sizeof(w));
+    return w;
+  }
+
+  void store(uint64_t byte, uint64_t w) {
+    word v = (word)w;
+    memcpy(data + byte, &v, sizeof(v));
+  }
+
+  uint8_t data[((uint64_t)N * Bits + 7) / 8 + sizeof(word) - 1];
+};
+
+// N fields of Bits bits each, one per byte (or per 16/32-bit word for
+// wider fields). Larger than PackedArray but cheaper to access.
+template <int Bits, uint32_t N> class UnpackedArray {
+  static_assert(Bits >= 1 && Bits <= 32);
+
+  typedef std::conditional_t<
+      Bits <= 8, uint8_t, std::conditional_t<Bits <= 16, uint16_t, uint32_t>>
+      field;
+
+public:
+  static constexpr uint32_t MAX = (uint32_t)((1ull << Bits) - 1);
+
+  void fill(uint32_t v) {
+    for (uint32_t i = 0; i < N; i++)
+      data[i] = (field)v;
+  }
+
+  uint32_t get(uint32_t i) const { return data[i]; }
+
+  void set(uint32_t i, uint32_t v) { data[i] = (field)v; }
+
+  int save(FILE *out) const {
+    return fwrite(data, sizeof(data), 1, out) == 1;
+  }
+  int restore(FILE *in) { return fread(data, sizeof(data), 1, in) == 1; }
+
+private:
+  field data[N];
+};
+
+// Saturating counters over either layout
+template <class Fields> class SaturatingCounters : public Fields {
+public:
+  using Fields::MAX;
+  using Fields::get;
+  using Fields::set;
+
+  // Counts counter 'i' up if 'up', else down, saturating at 0 and MAX
+  // without branching
+  //
+  // Returns the value before the update
+  //
+  uint32_t update(uint32_t i, uint32_t up) {
+    uint32_t v = get(i);
+    set(i, v + (up & (v != MAX)) - (!up & (v != 0)));
+    return v;
+  }
+};
+
+// Shift registers of outcome history over either layout
+template <class Fields> class ShiftHistories : public Fields {
+public:
+  using Fields::MAX;
+  using Fields::get;
+  using Fields::set;
+
+  // Shifts 'outcome' into history 'i', dropping its oldest bit
+  //
+  void push(uint32_t i, uint32_t outcome) {
+    set(i, ((get(i) << 1) | outcome) & MAX);
+  }
+};
+
+template <int Bits, uint32_t N>
+using PackedCounterArray = SaturatingCounters<PackedArray<Bits, N>>;
+template <int Bits, uint32_t N>
+using PackedHistoryArray = ShiftHistories<PackedArray<Bits, N>>;
+
+template <int Bits, uint32_t N>
+using UnpackedCounterArray = SaturatingCounters<UnpackedArray<Bits, N>>;
+template <int Bits, uint32_t N>
+using UnpackedHistoryArray = ShiftHistories<UnpackedArray<Bits, N>>;
+
+// Packing costs a few instructions per access, which only pays off once
+// the unpacked tables no longer fit in the L1 data cache. Predictors whose
+// unpacked tables add up to more than this pack all of them.
+#define PACK_ABOVE_BYTES 32768
+
+// Table storage of a predictor: packed above PACK_ABOVE_BYTES, never or
+// always. Always gives tables exactly the size of the modeled hardware.
+enum table_packing { PACK_AUTO, PACK_NEVER, PACK_ALWAYS };
+
+constexpr bool packs(table_packing packing, uint64_t unpacked_bytes) {
+  return packing == PACK_ALWAYS ||
+         (packing == PACK_AUTO && unpacked_bytes > PACK_ABOVE_BYTES);
+}
+
+template <bool Packed, int Bits, uint32_t N>
+using CounterArray = std::conditional_t<Packed, PackedCounterArray<Bits, N>,
+                                        UnpackedCounterArray<Bits, N>>;
+template <bool Packed, int Bits, uint32_t N>
+using HistoryArray = std::conditional_t<Packed, PackedHistoryArray<Bits, N>,
+                                        UnpackedHistoryArray<Bits, N>>;
+
+#endif
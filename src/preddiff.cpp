@@ -0,0 +1,116 @@
+//========================================================//
+//  preddiff.cpp                                          //
+//  Compares two prediction streams                       //
+//                                                        //
+//  Usage: preddiff <a> <b>                               //
+//  Both are written by predictor --predictions. Exits    //
+//  with 0 if they are identical, 1 if they differ        //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "predstream.h"
+
+// Bytes of each stream compared at a time
+#define CHUNK_BYTES (1 << 20)
+
+static FILE *open_stream(const char *path, uint64_t *count)
+{
+  FILE *in = fopen(path, "rb");
+  if (in == NULL)
+  {
+    fprintf(stderr, "preddiff: cannot read %s\n", path);
+    exit(2);
+  }
+  if (!pred_read_header(in, count))
+  {
+    fprintf(stderr, "preddiff: %s is not a prediction stream\n", path);
+    exit(2);
+  }
+  return in;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 3)
+  {
+    fprintf(stderr, "Usage: preddiff <a> <b>\n");
+    fprintf(stderr, "       <a> and <b> are written by predictor --predictions\n");
+    return 2;
+  }
+
+  uint64_t count[2];
+  FILE *in[2] = {open_stream(argv[1], &count[0]), open_stream(argv[2], &count[1])};
+
+  // Only the predictions both streams have are compared
+  uint64_t common = count[0] < count[1] ? count[0] : count[1];
+  uint64_t bytes = (common + 7) / 8;
+  uint8_t *chunk[2] = {(uint8_t *)malloc(CHUNK_BYTES), (uint8_t *)malloc(CHUNK_BYTES)};
+
+  uint64_t differ = 0;
+  uint64_t first = UINT64_MAX;
+  for (uint64_t at = 0; at < bytes; at += CHUNK_BYTES)
+  {
+    size_t n = bytes - at < CHUNK_BYTES ? bytes - at : CHUNK_BYTES;
+    for (int s = 0; s < 2; s++)
+    {
+      if (fread(chunk[s], 1, n, in[s]) != n)
+      {
+        fprintf(stderr, "preddiff: %s is truncated\n", argv[s + 1]);
+        return 2;
+      }
+    }
+
+    // The last byte of the shorter stream may run past 'common'
+    if (at + n == bytes && common % 8)
+    {
+      uint8_t mask = (uint8_t)((1 << (common % 8)) - 1);
+      chunk[0][n - 1] &= mask;
+      chunk[1][n - 1] &= mask;
+    }
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+      uint64_t a, b;
+      memcpy(&a, chunk[0] + i, 8);
+      memcpy(&b, chunk[1] + i, 8);
+      if (a != b)
+      {
+        differ += __builtin_popcountll(a ^ b);
+        if (first == UINT64_MAX)
+        {
+          // Find the byte, then the bit, whatever the host byte order
+          size_t j = i;
+          while (chunk[0][j] == chunk[1][j])
+            j++;
+          first = 8 * (at + j) + __builtin_ctz(chunk[0][j] ^ chunk[1][j]);
+        }
+      }
+    }
+    for (; i < n; i++)
+    {
+      uint8_t x = chunk[0][i] ^ chunk[1][i];
+      differ += __builtin_popcount(x);
+      if (x && first == UINT64_MAX)
+        first = 8 * (at + i) + __builtin_ctz(x);
+    }
+  }
+
+  printf("Predictions:     %12llu %12llu\n", (unsigned long long)count[0], (unsigned long long)count[1]);
+  printf("Differing:       %12llu", (unsigned long long)differ);
+  if (common)
+    printf(" (%.3f%%)", 100.0 * differ / common);
+  printf("\n");
+  if (first != UINT64_MAX)
+    printf("First differing: %12llu\n", (unsigned long long)first);
+  if (count[0] != count[1])
+    printf("Lengths differ\n");
+
+  free(chunk[0]);
+  free(chunk[1]);
+  fclose(in[0]);
+  fclose(in[1]);
+  return differ != 0 || count[0] != count[1];
+}
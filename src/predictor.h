@@ -70,6 +70,484 @@ void train_predictor(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t co
 // Please add your code below, and DO NOT MODIFY ANY OF THE CODE ABOVE
 // 
 
+#include "packed.h"
+#include "trace.h"
+#include <stdio.h>
 
+//------------------------------------//
+//        Predictor Instances         //
+//------------------------------------//
+
+// A predictor keeps all of its state, including its own global history, in
+// an instance, so any number of them can coexist in one process or run on
+// different threads. The functions above drive a single instance of type
+// bpType.
+class Predictor {
+public:
+  virtual ~Predictor() {}
+
+  // Same contract as make_prediction
+  virtual uint8_t predict(uint32_t pc, uint32_t target, uint32_t direct) = 0;
+
+  // Same contract as train_predictor
+  virtual void train(uint32_t pc, uint32_t target, uint32_t outcome,
+                     uint32_t condition, uint32_t call, uint32_t ret,
+                     uint32_t direct) = 0;
+
+  // Writes the complete state, tables and histories, to 'out' in a layout
+  // only the same class on the same kind of machine reads back
+  //
+  // Returns True if Successful
+  //
+  virtual int save_state(FILE *out) const = 0;
+
+  // Restores a state written by save_state
+  //
+  // Returns True if Successful
+  //
+  virtual int load_state(FILE *in) = 0;
+
+  // Names component 'id' of the predictor, the part of it a prediction
+  // may come from (see provider), or returns NULL past the last one. A
+  // predictor has one or two components.
+  //
+  virtual const char *component(int id) const {
+    return id == 0 ? "predictor" : NULL;
+  }
+
+  // Returns the component predict() takes its prediction from
+  //
+  virtual uint8_t provider(uint32_t pc, uint32_t target, uint32_t direct) {
+    return 0;
+  }
+
+  // Names table 'id' of the predictor, for alias analysis, and sets
+  // '*entries' to its size, or returns NULL past the last table
+  //
+  virtual const char *table(int id, uint32_t *entries) const { return NULL; }
+
+  // Sets entries[id] to the entry of each table that predicting and
+  // training a conditional branch at 'pc' would read and train next
+  //
+  virtual void table_entries(uint32_t pc, uint32_t *entries) const {}
+
+  // Returns the prediction entry 'entry' of table 'id' currently gives
+  //
+  virtual uint8_t table_prediction(int id, uint32_t entry) const {
+    return NOTTAKEN;
+  }
+
+  // Predicts and trains on every record of 'records' in order, exactly as
+  // predict() then train() per record would. Bit i % 64 of
+  // predictions[i / 64] receives the prediction for record i, or 0 if it
+  // is not a conditional branch. Unless 'providers' is NULL, the same bit
+  // of providers[i / 64] receives the provider of that prediction.
+  //
+  virtual void predict_batch(const branch_trace &records,
+                             uint64_t *predictions, uint64_t *providers);
+};
+
+// The loop behind predict_batch. Given a final class the calls to predict()
+// and train() are direct and can be inlined.
+//
+template <class P>
+void predict_each(P &predictor, const branch_trace &records,
+                  uint64_t *predictions, uint64_t *providers) {
+  for (uint64_t base = 0; base < records.count; base += 64) {
+    uint64_t n = records.count - base < 64 ? records.count - base : 64;
+    uint64_t bits = 0;
+    uint64_t from = 0;
+    for (uint64_t j = 0; j < n; j++) {
+      uint32_t pc = records.pc[base + j];
+      uint32_t target = records.target[base + j];
+      uint8_t flags = records.flags[base + j];
+      uint32_t outcome = (flags & TRACE_OUTCOME) != 0;
+      uint32_t condition = (flags & TRACE_CONDITION) != 0;
+      uint32_t direct = (flags & TRACE_DIRECT) != 0;
+      if (condition) {
+        if (providers != NULL)
+          from |= (uint64_t)predictor.provider(pc, target, direct) << j;
+        bits |= (uint64_t)predictor.predict(pc, target, direct) << j;
+      }
+      predictor.train(pc, target, outcome, condition,
+                      (flags & TRACE_CALL) != 0, (flags & TRACE_RET) != 0,
+                      direct);
+    }
+    predictions[base / 64] = bits;
+    if (providers != NULL)
+      providers[base / 64] = from;
+  }
+}
+
+inline void Predictor::predict_batch(const branch_trace &records,
+                                     uint64_t *predictions,
+                                     uint64_t *providers) {
+  predict_each(*this, records, predictions, providers);
+}
+
+// Returns a mask with bit j set if flags[j] has all of 'bits' set, for the
+// next 'n' (at most 64) records
+//
+static inline uint64_t flag_mask(const uint8_t *flags, uint64_t n,
+                                 uint8_t bits) {
+  uint64_t mask = 0;
+  if (n < 64) {
+    for (uint64_t j = 0; j < n; j++)
+      mask |= (uint64_t)((flags[j] & bits) == bits) << j;
+    return mask;
+  }
+
+  // Eight flags at a time: bytes of y are zero where all bits are set, z
+  // keeps the top bit of exactly those bytes and the multiply gathers the
+  // eight top bits into the high byte
+  const uint64_t ones = 0x0101010101010101ull;
+  const uint64_t low7 = 0x7f7f7f7f7f7f7f7full;
+  for (int k = 0; k < 8; k++) {
+    uint64_t x;
+    memcpy(&x, flags + 8 * k, sizeof(x));
+    uint64_t y = (x & (bits * ones)) ^ (bits * ones);
+    uint64_t z = ~(((y & low7) + low7) | y) & ~low7;
+    mask |= (((z >> 7) * 0x0102040810204080ull) >> 56) << (8 * k);
+  }
+  return mask;
+}
+
+// Predicts and trains the bpType predictor on 'count' records given as
+// columns, see Predictor::predict_batch. Embedding simulators can hand over
+// thousands of branches per call.
+//
+void predict_and_train_batch(const uint32_t *pc, const uint32_t *target,
+                             const uint8_t *flags, uint64_t count,
+                             uint64_t *predictions);
+
+// Returns a new predictor of type 'type' (STATIC, GSHARE, ...), or NULL
+// for an unknown type
+//
+Predictor *new_predictor(int type);
+
+// Hardware budget of every predictor: 64Kbits of tables plus 1024 bits for
+// registers and such
+#define PREDICTOR_BUDGET_BITS (65536 + 1024)
+
+constexpr bool fits_budget(uint64_t bits) {
+  return bits <= PREDICTOR_BUDGET_BITS;
+}
+
+// The predictors below are templates over their table and counter widths,
+// so every configuration is a separate class with constant masks. Each has
+// a constexpr budget_bits() giving the storage it models. Tables too big
+// for the L1 cache unpacked are bit packed down to that size.
+
+class StaticPredictor final : public Predictor {
+public:
+  static constexpr uint64_t budget_bits() { return 0; }
+
+  uint8_t predict(uint32_t pc, uint32_t target, uint32_t direct) override {
+    return TAKEN;
+  }
+
+  void train(uint32_t pc, uint32_t target, uint32_t outcome,
+             uint32_t condition, uint32_t call, uint32_t ret,
+             uint32_t direct) override {}
+
+  int save_state(FILE *out) const override { return 1; }
+  int load_state(FILE *in) override { return 1; }
+
+  const char *component(int id) const override {
+    return id == 0 ? "static" : NULL;
+  }
+
+  void predict_batch(const branch_trace &records, uint64_t *predictions,
+                     uint64_t *providers) override {
+    for (uint64_t base = 0; base < records.count; base += 64) {
+      uint64_t n = records.count - base < 64 ? records.count - base : 64;
+      predictions[base / 64] =
+          flag_mask(records.flags + base, n, TRACE_CONDITION);
+      if (providers != NULL)
+        providers[base / 64] = 0;
+    }
+  }
+};
+
+//------------------------------------//
+//         Gshare Predictor           //
+//------------------------------------//
+
+// A table of 2^HistoryBits counters indexed by the pc xor the global history
+template <int HistoryBits, table_packing Packing = PACK_AUTO,
+          int CounterBits = 2>
+class GsharePredictor final : public Predictor {
+public:
+  static constexpr int HISTORY_BITS = HistoryBits;
+
+  static constexpr uint64_t budget_bits() {
+    return ((uint64_t)CounterBits << HistoryBits) + HistoryBits;
+  }
+
+  GsharePredictor() {
+    bht.fill(WEAK_NOT_TAKEN);
+    ghistory = 0;
+  }
+
+  uint8_t predict(uint32_t pc, uint32_t target, uint32_t direct) override {
+    return bht.get(index(pc)) >> (CounterBits - 1);
+  }
+
+  void train(uint32_t pc, uint32_t target, uint32_t outcome,
+             uint32_t condition, uint32_t call, uint32_t ret,
+             uint32_t direct) override {
+    if (!condition)
+      return;
+
+    // Update state of entry in bht based on outcome
+    bht.update(index(pc), outcome);
+
+    // Update history register
+    ghistory = ((ghistory << 1) | outcome);
+  }
+
+  int save_state(FILE *out) const override {
+    return fwrite(&ghistory, sizeof(ghistory), 1, out) == 1 && bht.save(out);
+  }
+
+  int load_state(FILE *in) override {
+    return fread(&ghistory, sizeof(ghistory), 1, in) == 1 && bht.restore(in);
+  }
+
+  const char *component(int id) const override {
+    return id == 0 ? "gshare" : NULL;
+  }
+
+  const char *table(int id, uint32_t *entries) const override {
+    *entries = ENTRIES;
+    return id == 0 ? "bht" : NULL;
+  }
+
+  void table_entries(uint32_t pc, uint32_t *entries) const override {
+    entries[0] = index(pc);
+  }
+
+  uint8_t table_prediction(int id, uint32_t entry) const override {
+    return bht.get(entry) >> (CounterBits - 1);
+  }
+
+  void predict_batch(const branch_trace &records, uint64_t *predictions,
+                     uint64_t *providers) override {
+    // Keep the history and the columns in registers rather than reloading
+    // them around every counter store
+    const uint32_t *pcs = records.pc;
+    const uint8_t *flags = records.flags;
+    uint64_t history = ghistory;
+
+    for (uint64_t base = 0; base < records.count; base += 64) {
+      uint64_t n = records.count - base < 64 ? records.count - base : 64;
+      uint64_t bits = 0;
+      for (uint64_t j = 0; j < n; j++) {
+        uint8_t f = flags[base + j];
+        if (!(f & TRACE_CONDITION))
+          continue;
+        uint32_t outcome = f & TRACE_OUTCOME;
+        uint32_t counter = bht.update(
+            (pcs[base + j] ^ (uint32_t)history) & (ENTRIES - 1), outcome);
+        bits |= (uint64_t)(counter >> (CounterBits - 1)) << j;
+        history = (history << 1) | outcome;
+      }
+      predictions[base / 64] = bits;
+      if (providers != NULL)
+        providers[base / 64] = 0;
+    }
+
+    ghistory = history;
+  }
+
+private:
+  static constexpr uint32_t ENTRIES = 1u << HistoryBits;
+  static constexpr uint8_t WEAK_NOT_TAKEN = (1u << (CounterBits - 1)) - 1;
+  static constexpr bool PACKED =
+      packs(Packing, sizeof(UnpackedCounterArray<CounterBits, ENTRIES>));
+
+  uint32_t index(uint32_t pc) const {
+    return (pc ^ (uint32_t)ghistory) & (ENTRIES - 1);
+  }
+
+  uint64_t ghistory;
+  CounterArray<PACKED, CounterBits, ENTRIES> bht;
+};
+
+//------------------------------------//
+//    Tournament/Custom Predictors    //
+//------------------------------------//
+
+// Alpha 21264 style hybrid: a chooser picks between a global history
+// predictor and a two level local one. With HashPc the global table and the
+// chooser are indexed by the history xor the pc rather than the history
+// alone.
+template <int LocHistBits, // Number of bits used for Local History
+          int LocMaskBits, // Number of PC bits to use to index into LHT
+          int GlbHistBits, // Number of bits used for Global History
+          int ChooserBits, // Number of bits used for chooser
+          bool HashPc, table_packing Packing = PACK_AUTO, int GlbCtrBits = 2,
+          int LocCtrBits = 3, int ChooserCtrBits = 2>
+class HybridPredictor final : public Predictor {
+public:
+  static constexpr uint64_t budget_bits() {
+    return ((uint64_t)ChooserCtrBits << ChooserBits) +
+           ((uint64_t)LocHistBits << LocMaskBits) +
+           ((uint64_t)GlbCtrBits << GlbHistBits) +
+           ((uint64_t)LocCtrBits << LocHistBits) +
+           (GlbHistBits > ChooserBits ? GlbHistBits : ChooserBits);
+  }
+
+  HybridPredictor() {
+    // Choosers start weakly local, local counters weakly not taken and
+    // global counters weakly taken, with all histories cleared
+    chooser.fill((1u << (ChooserCtrBits - 1)) - 1);
+    loc_bht.fill((1u << (LocCtrBits - 1)) - 1);
+    glb_bht.fill(1u << (GlbCtrBits - 1));
+    lht.fill(0);
+    ghistory = 0;
+  }
+
+  uint8_t predict(uint32_t pc, uint32_t target, uint32_t direct) override {
+    uint32_t key = global_key(pc);
+    if (provider(pc, target, direct))
+      // Calculate global prediction
+      return glb_bht.get(key & GLB_MASK) >> (GlbCtrBits - 1);
+    // Calculate local prediction
+    return loc_bht.get(lht.get(pc & LHT_MASK)) >> (LocCtrBits - 1);
+  }
+
+  void train(uint32_t pc, uint32_t target, uint32_t outcome,
+             uint32_t condition, uint32_t call, uint32_t ret,
+             uint32_t direct) override {
+    if (!condition)
+      return;
+
+    uint32_t from_global;
+    step(pc, global_key(pc), outcome, from_global);
+    ghistory = ((ghistory << 1) | outcome);
+  }
+
+  int save_state(FILE *out) const override {
+    return fwrite(&ghistory, sizeof(ghistory), 1, out) == 1 &&
+           chooser.save(out) && lht.save(out) && glb_bht.save(out) &&
+           loc_bht.save(out);
+  }
+
+  int load_state(FILE *in) override {
+    return fread(&ghistory, sizeof(ghistory), 1, in) == 1 &&
+           chooser.restore(in) && lht.restore(in) && glb_bht.restore(in) &&
+           loc_bht.restore(in);
+  }
+
+  const char *component(int id) const override {
+    return id == 0 ? "local" : id == 1 ? "global" : NULL;
+  }
+
+  uint8_t provider(uint32_t pc, uint32_t target, uint32_t direct) override {
+    return chooser.get(global_key(pc) & CHOOSER_MASK) >> (ChooserCtrBits - 1);
+  }
+
+  // The global counters and the local histories, each history standing
+  // for the local counter it selects
+  const char *table(int id, uint32_t *entries) const override {
+    *entries = id == 0 ? GLB_MASK + 1 : LHT_MASK + 1;
+    return id == 0 ? "glb_bht" : id == 1 ? "lht" : NULL;
+  }
+
+  void table_entries(uint32_t pc, uint32_t *entries) const override {
+    entries[0] = global_key(pc) & GLB_MASK;
+    entries[1] = pc & LHT_MASK;
+  }
+
+  uint8_t table_prediction(int id, uint32_t entry) const override {
+    if (id == 0)
+      return glb_bht.get(entry) >> (GlbCtrBits - 1);
+    return loc_bht.get(lht.get(entry)) >> (LocCtrBits - 1);
+  }
+
+  void predict_batch(const branch_trace &records, uint64_t *predictions,
+                     uint64_t *providers) override {
+    // As for gshare, the global history stays in a register
+    const uint32_t *pcs = records.pc;
+    const uint8_t *flags = records.flags;
+    uint64_t history = ghistory;
+
+    for (uint64_t base = 0; base < records.count; base += 64) {
+      uint64_t n = records.count - base < 64 ? records.count - base : 64;
+      uint64_t bits = 0;
+      uint64_t from = 0;
+      for (uint64_t j = 0; j < n; j++) {
+        uint8_t f = flags[base + j];
+        if (!(f & TRACE_CONDITION))
+          continue;
+        uint32_t pc = pcs[base + j];
+        uint32_t outcome = f & TRACE_OUTCOME;
+        uint32_t key = HashPc ? (uint32_t)history ^ pc : (uint32_t)history;
+        uint32_t from_global;
+        bits |= (uint64_t)step(pc, key, outcome, from_global) << j;
+        from |= (uint64_t)from_global << j;
+        history = (history << 1) | outcome;
+      }
+      predictions[base / 64] = bits;
+      if (providers != NULL)
+        providers[base / 64] = from;
+    }
+
+    ghistory = history;
+  }
+
+private:
+  static constexpr uint32_t CHOOSER_MASK = (1u << ChooserBits) - 1;
+  static constexpr uint32_t GLB_MASK = (1u << GlbHistBits) - 1;
+  static constexpr uint32_t LHT_MASK = (1u << LocMaskBits) - 1;
+  static constexpr bool PACKED =
+      packs(Packing,
+            sizeof(UnpackedCounterArray<ChooserCtrBits, 1u << ChooserBits>) +
+                sizeof(UnpackedHistoryArray<LocHistBits, 1u << LocMaskBits>) +
+                sizeof(UnpackedCounterArray<GlbCtrBits, 1u << GlbHistBits>) +
+                sizeof(UnpackedCounterArray<LocCtrBits, 1u << LocHistBits>));
+
+  uint32_t global_key(uint32_t pc) const {
+    return HashPc ? (uint32_t)ghistory ^ pc : (uint32_t)ghistory;
+  }
+
+  // Trains every table but the global history on a conditional branch
+  // whose global side is indexed by 'key', setting 'use_global' if the
+  // chooser picked the global side
+  //
+  // Returns the prediction made before training
+  //
+  uint32_t step(uint32_t pc, uint32_t key, uint32_t outcome,
+                uint32_t &use_global) {
+    uint32_t lht_index = pc & LHT_MASK;
+    use_global = chooser.get(key & CHOOSER_MASK) >> (ChooserCtrBits - 1);
+
+    // Update global and local bht
+    uint32_t glb_prediction =
+        glb_bht.update(key & GLB_MASK, outcome) >> (GlbCtrBits - 1);
+    uint32_t loc_prediction =
+        loc_bht.update(lht.get(lht_index), outcome) >> (LocCtrBits - 1);
+
+    // If global and local guessed differently, then update the correct one
+    if (glb_prediction != loc_prediction)
+      chooser.update(key & CHOOSER_MASK, outcome == glb_prediction);
+
+    lht.push(lht_index, outcome);
+    return loc_prediction ^ ((glb_prediction ^ loc_prediction) & use_global);
+  }
+
+  uint64_t ghistory;
+  // chooses between global and local
+  CounterArray<PACKED, ChooserCtrBits, 1u << ChooserBits> chooser;
+  HistoryArray<PACKED, LocHistBits, 1u << LocMaskBits> lht; // local history
+  CounterArray<PACKED, GlbCtrBits, 1u << GlbHistBits> glb_bht;
+  CounterArray<PACKED, LocCtrBits, 1u << LocHistBits> loc_bht;
+};
+
+// The configurations handed in
+typedef GsharePredictor<15> DefaultGsharePredictor;
+typedef HybridPredictor<11, 11, 13, 13, false> TournamentPredictor;
+typedef HybridPredictor<10, 11, 14, 12, true> CustomPredictor;
 
 #endif
@@ -0,0 +1,199 @@
+//========================================================//
+//  predstream.cpp                                        //
+//  Source file for prediction streams                    //
+//========================================================//
+#include "predstream.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Predictions are gathered in whole 64-bit words and written out a buffer
+// at a time
+#define PRED_BUFFER_WORDS (1 << 17)
+
+// Mispredict events are encoded straight into a buffer of this many
+#define MISS_BUFFER_EVENTS (1 << 16)
+
+struct pred_writer {
+  FILE *out;
+  uint64_t count;  // Predictions appended so far
+  uint64_t word;   // Bits not yet in the buffer
+  int word_bits;   // Number of them
+  size_t buffered; // Whole words in the buffer
+  int ok;
+  uint64_t buffer[PRED_BUFFER_WORDS];
+};
+
+static void put_u64(uint8_t *bytes, uint64_t v) {
+  for (int i = 0; i < 8; i++)
+    bytes[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put_u32(uint8_t *bytes, uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    bytes[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void write_header(pred_writer *writer) {
+  uint8_t header[PRED_HEADER_SIZE];
+  memcpy(header, PRED_MAGIC, PRED_MAGIC_LEN);
+  put_u64(header + PRED_MAGIC_LEN, writer->count);
+  if (fwrite(header, sizeof(header), 1, writer->out) != 1)
+    writer->ok = 0;
+}
+
+// Writes out 'bytes' bytes of the buffer
+//
+static void flush(pred_writer *writer, size_t bytes) {
+  // Words go out little endian, whatever the host
+  uint8_t *out = (uint8_t *)writer->buffer;
+  for (size_t i = 0; i < writer->buffered; i++)
+    put_u64(out + 8 * i, writer->buffer[i]);
+  if (bytes && fwrite(out, bytes, 1, writer->out) != 1)
+    writer->ok = 0;
+  writer->buffered = 0;
+}
+
+pred_writer *pred_writer_open(const char *path) {
+  FILE *out = fopen(path, "wb");
+  if (out == NULL)
+    return NULL;
+
+  pred_writer *writer = (pred_writer *)malloc(sizeof(pred_writer));
+  writer->out = out;
+  writer->count = 0;
+  writer->word = 0;
+  writer->word_bits = 0;
+  writer->buffered = 0;
+  writer->ok = 1;
+  write_header(writer);
+  return writer;
+}
+
+void pred_writer_put(pred_writer *writer, uint64_t bits, int n) {
+  if (n == 0)
+    return;
+  if (n < 64)
+    bits &= (1ull << n) - 1;
+  writer->count += n;
+
+  writer->word |= bits << writer->word_bits;
+  if (writer->word_bits + n < 64) {
+    writer->word_bits += n;
+    return;
+  }
+
+  // The word is full; start the next with what did not fit
+  writer->buffer[writer->buffered++] = writer->word;
+  writer->word = writer->word_bits ? bits >> (64 - writer->word_bits) : 0;
+  writer->word_bits = writer->word_bits + n - 64;
+  if (writer->buffered == PRED_BUFFER_WORDS)
+    flush(writer, sizeof(writer->buffer));
+}
+
+int pred_writer_close(pred_writer *writer) {
+  if (writer->word_bits) {
+    writer->buffer[writer->buffered++] = writer->word;
+    flush(writer, 8 * (writer->buffered - 1) + (writer->word_bits + 7) / 8);
+  } else {
+    flush(writer, 8 * writer->buffered);
+  }
+
+  // Patch in the final count
+  if (fseek(writer->out, 0, SEEK_SET) == 0)
+    write_header(writer);
+  else
+    writer->ok = 0;
+
+  int ok = fclose(writer->out) == 0 && writer->ok;
+  free(writer);
+  return ok;
+}
+
+int pred_read_header(FILE *in, uint64_t *count) {
+  uint8_t header[PRED_HEADER_SIZE];
+  if (fread(header, sizeof(header), 1, in) != 1 ||
+      memcmp(header, PRED_MAGIC, PRED_MAGIC_LEN))
+    return 0;
+  *count = 0;
+  for (int i = 0; i < 8; i++)
+    *count |= (uint64_t)header[PRED_MAGIC_LEN + i] << (8 * i);
+  return 1;
+}
+
+struct miss_writer {
+  FILE *out;
+  uint64_t count;  // Events appended so far
+  size_t buffered; // Events in the buffer
+  int ok;
+  uint8_t buffer[MISS_BUFFER_EVENTS * MISS_EVENT_SIZE];
+};
+
+// Writes the magic and the count, leaving the component names in place
+//
+static void write_miss_count(miss_writer *writer) {
+  uint8_t header[MISS_MAGIC_LEN + 8];
+  memcpy(header, MISS_MAGIC, MISS_MAGIC_LEN);
+  put_u64(header + MISS_MAGIC_LEN, writer->count);
+  if (fwrite(header, sizeof(header), 1, writer->out) != 1)
+    writer->ok = 0;
+}
+
+static void flush_events(miss_writer *writer) {
+  size_t bytes = writer->buffered * MISS_EVENT_SIZE;
+  if (bytes && fwrite(writer->buffer, bytes, 1, writer->out) != 1)
+    writer->ok = 0;
+  writer->buffered = 0;
+}
+
+miss_writer *miss_writer_open(const char *path, const char *const *components,
+                              int num_components) {
+  FILE *out = fopen(path, "wb");
+  if (out == NULL)
+    return NULL;
+
+  miss_writer *writer = (miss_writer *)malloc(sizeof(miss_writer));
+  writer->out = out;
+  writer->count = 0;
+  writer->buffered = 0;
+  writer->ok = 1;
+  write_miss_count(writer);
+
+  uint8_t n = (uint8_t)num_components;
+  if (fwrite(&n, 1, 1, out) != 1)
+    writer->ok = 0;
+  for (int i = 0; i < num_components; i++) {
+    size_t len = strlen(components[i]);
+    uint8_t len_byte = (uint8_t)(len < 255 ? len : 255);
+    if (fwrite(&len_byte, 1, 1, out) != 1 ||
+        (len_byte && fwrite(components[i], len_byte, 1, out) != 1))
+      writer->ok = 0;
+  }
+  return writer;
+}
+
+void miss_writer_put(miss_writer *writer, uint64_t index, uint32_t pc,
+                     uint32_t target, uint8_t outcome, uint8_t component) {
+  uint8_t *event = writer->buffer + writer->buffered * MISS_EVENT_SIZE;
+  put_u64(event, index);
+  put_u32(event + 8, pc);
+  put_u32(event + 12, target);
+  event[16] = outcome;
+  event[17] = component;
+  writer->count++;
+  if (++writer->buffered == MISS_BUFFER_EVENTS)
+    flush_events(writer);
+}
+
+int miss_writer_close(miss_writer *writer) {
+  flush_events(writer);
+
+  // Patch in the final count
+  if (fseek(writer->out, 0, SEEK_SET) == 0)
+    write_miss_count(writer);
+  else
+    writer->ok = 0;
+
+  int ok = fclose(writer->out) == 0 && writer->ok;
+  free(writer);
+  return ok;
+}
@@ -0,0 +1,80 @@
+//========================================================//
+//  predstream.h                                          //
+//  Header file for prediction streams                    //
+//                                                        //
+//  The predictions of a run packed one bit per counted   //
+//  conditional branch, for quick equivalence checks      //
+//  between predictor versions (see preddiff), and logs   //
+//  of just the mispredicted branches                     //
+//========================================================//
+
+#ifndef PREDSTREAM_H
+#define PREDSTREAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// A prediction stream starts with a 16 byte header: the 8 byte magic below
+// followed by the little endian 64-bit prediction count. The predictions
+// follow in trace order, eight per byte starting from the least
+// significant bit, with the last byte padded with zeros.
+#define PRED_MAGIC "BPPREDS1"
+#define PRED_MAGIC_LEN 8
+#define PRED_HEADER_SIZE 16
+
+typedef struct pred_writer pred_writer;
+
+// Starts a prediction stream at 'path'
+// Returns NULL if the file cannot be created
+//
+pred_writer *pred_writer_open(const char *path);
+
+// Appends the low 'n' bits of 'bits' (n <= 64), lowest first
+//
+void pred_writer_put(pred_writer *writer, uint64_t bits, int n);
+
+// Flushes the stream, writes the final count and frees the writer
+//
+// Returns True if Successful
+//
+int pred_writer_close(pred_writer *writer);
+
+// Reads the header of the stream open on 'in', leaving it at the first
+// prediction
+//
+// Returns True if 'in' is a prediction stream
+//
+int pred_read_header(FILE *in, uint64_t *count);
+
+// A mispredict log starts with the 8 byte magic below, the little endian
+// 64-bit event count, a byte giving the number of predictor components and
+// their names, each a length byte followed by the name. Then come the
+// events, each MISS_EVENT_SIZE bytes: the 64-bit index of the record in the
+// trace, the 32-bit pc and target, the outcome byte and the byte giving the
+// component that provided the prediction, all little endian.
+#define MISS_MAGIC "BPMISS01"
+#define MISS_MAGIC_LEN 8
+#define MISS_EVENT_SIZE 18
+
+typedef struct miss_writer miss_writer;
+
+// Starts a mispredict log at 'path' for a predictor with 'num_components'
+// components named 'components'
+// Returns NULL if the file cannot be created
+//
+miss_writer *miss_writer_open(const char *path, const char *const *components,
+                              int num_components);
+
+// Appends the misprediction of record 'index', a branch at 'pc' to 'target'
+// with outcome 'outcome', predicted by component 'component'
+//
+void miss_writer_put(miss_writer *writer, uint64_t index, uint32_t pc,
+                     uint32_t target, uint8_t outcome, uint8_t component);
+
+// Flushes the log, writes the final count and frees the writer
+//
+// Returns True if Successful
+//
+int miss_writer_close(miss_writer *writer);
+
+#endif
@@ -0,0 +1,51 @@
+//========================================================//
+//  profile.cpp                                           //
+//  Source file for per branch profiles                   //
+//========================================================//
+#include "profile.h"
+#include <algorithm>
+#include <vector>
+
+void print_profile(FILE *out, const pc_stats *profile,
+                   const branch_trace &trace, int top) {
+  uint64_t executions = 0;
+  uint64_t mispredicts = 0;
+  std::vector<uint32_t> ids;
+  for (uint32_t id = 0; id < trace.pc_count; id++) {
+    executions += profile[id].executions;
+    mispredicts += profile[id].mispredicts;
+    if (profile[id].executions)
+      ids.push_back(id);
+  }
+
+  // Most mispredictions first, ties by pc so the report is stable
+  size_t shown = std::min(ids.size(), (size_t)top);
+  std::partial_sort(ids.begin(), ids.begin() + shown, ids.end(),
+                    [&](uint32_t a, uint32_t b) {
+                      if (profile[a].mispredicts != profile[b].mispredicts)
+                        return profile[a].mispredicts > profile[b].mispredicts;
+                      return trace.pcs[a] < trace.pcs[b];
+                    });
+
+  fprintf(out, "%zu conditional branch PCs, %llu executions, %llu mispredicted\n",
+          ids.size(), (unsigned long long)executions,
+          (unsigned long long)mispredicts);
+  // Rate is the part of the misprediction rate of the run due to the
+  // branch, in mispredictions per 1000 branches
+  fprintf(out, "%4s %10s %12s %11s %7s %8s %8s %7s %7s\n", "Rank", "PC",
+          "Executions", "Mispredicts", "Rate", "Miss %", "Taken %", "Share",
+          "Cumul");
+
+  double cumulative = 0;
+  for (size_t r = 0; r < shown; r++) {
+    const pc_stats &branch = profile[ids[r]];
+    double share = mispredicts ? 100.0 * branch.mispredicts / mispredicts : 0;
+    cumulative += share;
+    fprintf(out, "%4zu %10x %12llu %11llu %7.3f %8.2f %8.2f %6.2f%% %6.2f%%\n",
+            r + 1, trace.pcs[ids[r]], (unsigned long long)branch.executions,
+            (unsigned long long)branch.mispredicts,
+            1000.0 * branch.mispredicts / executions,
+            100.0 * branch.mispredicts / branch.executions,
+            100.0 * branch.taken / branch.executions, share, cumulative);
+  }
+}
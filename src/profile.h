@@ -0,0 +1,23 @@
+//========================================================//
+//  profile.h                                             //
+//  Header file for per branch profiles                   //
+//                                                        //
+//  Breaks the mispredictions of a run down by static     //
+//  branch, to show which few branches the misprediction  //
+//  rate comes from                                       //
+//========================================================//
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "simulate.h"
+#include <stdio.h>
+
+// Prints the 'top' static branches of 'trace' with the most mispredictions
+// in 'profile' (see sim_output), with their share of all of them and the
+// running total of that share
+//
+void print_profile(FILE *out, const pc_stats *profile,
+                   const branch_trace &trace, int top);
+
+#endif
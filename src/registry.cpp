@@ -0,0 +1,50 @@
+//========================================================//
+//  registry.cpp                                          //
+//  Source file for the registry of predictor types       //
+//                                                        //
+//  Kept apart from predictor.cpp so the predictors       //
+//  themselves build without the simulator                //
+//========================================================//
+#include "simulate.h"
+#include <string.h>
+#include <vector>
+
+// The configurations handed in, with their tables packed to the size of
+// the modeled hardware
+typedef GsharePredictor<15, PACK_ALWAYS> PackedGsharePredictor;
+typedef HybridPredictor<11, 11, 13, 13, false, PACK_ALWAYS>
+    PackedTournamentPredictor;
+typedef HybridPredictor<10, 11, 14, 12, true, PACK_ALWAYS>
+    PackedCustomPredictor;
+
+static std::vector<predictor_info> &registry() {
+  static std::vector<predictor_info> predictors;
+  return predictors;
+}
+
+int register_predictor(const char *name, predictor_factory create,
+                       predictor_runner run) {
+  if (find_predictor(name) != NULL)
+    return 0;
+  registry().push_back({name, create, run});
+  return 1;
+}
+
+const predictor_info *find_predictor(const char *name) {
+  for (const predictor_info &info : registry())
+    if (!strcmp(info.name, name))
+      return &info;
+  return NULL;
+}
+
+int num_predictors() { return (int)registry().size(); }
+
+const predictor_info *predictor_at(int i) { return &registry()[i]; }
+
+REGISTER_PREDICTOR("static", StaticPredictor);
+REGISTER_PREDICTOR("gshare", DefaultGsharePredictor);
+REGISTER_PREDICTOR("tournament", TournamentPredictor);
+REGISTER_PREDICTOR("custom", CustomPredictor);
+REGISTER_PREDICTOR("gshare-packed", PackedGsharePredictor);
+REGISTER_PREDICTOR("tournament-packed", PackedTournamentPredictor);
+REGISTER_PREDICTOR("custom-packed", PackedCustomPredictor);
@@ -0,0 +1,287 @@
+//========================================================//
+//  runner.cpp                                            //
+//  Source file for the multi-trace runner                //
+//                                                        //
+//  A trace stays loaded until the last of its predictor  //
+//  jobs is done with it                                  //
+//========================================================//
+#include "runner.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <math.h>
+#include <memory>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// A loaded trace shared by its predictor jobs
+typedef struct {
+  branch_trace trace;
+  std::atomic<int> users; // Jobs yet to finish with it
+} shared_trace;
+
+// Loads the window of one trace
+//
+// Returns the trace, or NULL with result->error set
+//
+static shared_trace *load_trace(trace_result *result, sim_window window) {
+  trace_reader *reader =
+      result->path ? trace_open_path(result->path) : trace_open(stdin);
+  if (reader == NULL) {
+    result->error = "unreadable";
+    return NULL;
+  }
+
+  shared_trace *shared = new shared_trace;
+  uint64_t count = window.limit ? window.warmup + window.limit : UINT64_MAX;
+  if (!trace_seek(reader, window.skip)) {
+    result->error = "too short";
+  } else if (!trace_load(reader, &shared->trace, count)) {
+    result->error = "out of memory";
+  }
+  trace_close(reader);
+
+  if (result->error != NULL) {
+    delete shared;
+    return NULL;
+  }
+  result->records = shared->trace.count;
+  return shared;
+}
+
+void run_traces(const char **paths, int num_paths,
+                const predictor_info **types, int num_types,
+                sim_window window, int threads, trace_result *results,
+                run_summary *summary) {
+  memset(results, 0, num_paths * sizeof(trace_result));
+  for (int i = 0; i < num_paths; i++) {
+    results[i].path = paths[i];
+    results[i].stats = (sim_stats *)calloc(num_types, sizeof(sim_stats));
+    results[i].sim_seconds = (double *)calloc(num_types, sizeof(double));
+  }
+
+  // Queue the biggest files first so the longest traces are not left for
+  // last; stdin and unreadable paths count as empty
+  std::vector<std::pair<off_t, int>> order;
+  for (int i = 0; i < num_paths; i++) {
+    struct stat st;
+    off_t size = paths[i] && stat(paths[i], &st) == 0 ? st.st_size : 0;
+    order.push_back({-size, i});
+  }
+  std::sort(order.begin(), order.end());
+
+  JobScheduler scheduler(threads);
+
+  // Traces loading at once share the cores for decoding .bz2 files,
+  // rather than each starting a decoder per core
+  int decode_threads = trace_decode_threads;
+  int loading = std::max(1, std::min(scheduler.threads(), num_paths));
+  int share = std::max(1, (int)std::thread::hardware_concurrency() / loading);
+  if (trace_decode_threads <= 0 || trace_decode_threads > share)
+    trace_decode_threads = share;
+
+  for (const std::pair<off_t, int> &entry : order) {
+    trace_result *result = &results[entry.second];
+    scheduler.submit([=, &scheduler](int) {
+      double start = now();
+      shared_trace *shared = load_trace(result, window);
+      result->load_seconds = now() - start;
+      if (shared == NULL)
+        return;
+      if (num_types == 0) {
+        trace_free(&shared->trace);
+        delete shared;
+        return;
+      }
+
+      // Hand each type to a job of its own, which this worker runs next
+      // unless an idle one steals it first
+      shared->users = num_types;
+      for (int t = 0; t < num_types; t++) {
+        scheduler.submit([=](int) {
+          double start = now();
+          Predictor *predictor = types[t]->create();
+          result->stats[t] =
+              types[t]->run(predictor, shared->trace, window.warmup, NULL);
+          delete predictor;
+          result->sim_seconds[t] = now() - start;
+
+          if (--shared->users == 0) {
+            trace_free(&shared->trace);
+            delete shared;
+          }
+        });
+      }
+    });
+  }
+  scheduler.run();
+  trace_decode_threads = decode_threads;
+
+  for (int i = 0; i < num_paths; i++) {
+    results[i].seconds = results[i].load_seconds;
+    for (int t = 0; t < num_types; t++)
+      results[i].seconds += results[i].sim_seconds[t];
+  }
+
+  if (summary != NULL) {
+    summary->threads = scheduler.threads();
+    summary->jobs = scheduler.jobs_run();
+    summary->wall_seconds = scheduler.wall_seconds();
+    summary->busy_seconds = scheduler.busy_seconds();
+  }
+}
+
+void run_shards(const branch_trace &trace, const predictor_info **types,
+                int num_types, uint64_t warmup, int shards,
+                uint64_t shard_warmup, int threads, sim_stats *stats,
+                sim_stats *sequential, run_summary *summary) {
+  // Counted records, split as evenly as they go
+  uint64_t begin = std::min(warmup, trace.count);
+  uint64_t counted = trace.count - begin;
+  std::vector<sim_stats> shard_stats((size_t)num_types * shards);
+
+  JobScheduler scheduler(threads);
+  for (int t = 0; t < num_types; t++) {
+    // The reference run is the longest job, so it goes first
+    if (sequential != NULL) {
+      scheduler.submit([=, &trace](int) {
+        Predictor *predictor = types[t]->create();
+        sequential[t] = types[t]->run(predictor, trace, warmup, NULL);
+        delete predictor;
+      });
+    }
+
+    for (int k = 0; k < shards; k++) {
+      sim_stats *out = &shard_stats[(size_t)t * shards + k];
+      scheduler.submit([=, &trace](int) {
+        uint64_t start = begin + counted * k / shards;
+        uint64_t end = begin + counted * (k + 1) / shards;
+        uint64_t prefix = k == 0 ? start : std::min(shard_warmup, start);
+
+        Predictor *predictor = types[t]->create();
+        *out = types[t]->run(
+            predictor, trace_slice(trace, start - prefix, end - start + prefix),
+            prefix, NULL);
+        delete predictor;
+      });
+    }
+  }
+  scheduler.run();
+
+  for (int t = 0; t < num_types; t++) {
+    stats[t] = {0, 0};
+    for (int k = 0; k < shards; k++) {
+      stats[t].num_branches += shard_stats[(size_t)t * shards + k].num_branches;
+      stats[t].mispredictions +=
+          shard_stats[(size_t)t * shards + k].mispredictions;
+    }
+  }
+
+  if (summary != NULL) {
+    summary->threads = scheduler.threads();
+    summary->jobs = scheduler.jobs_run();
+    summary->wall_seconds = scheduler.wall_seconds();
+    summary->busy_seconds = scheduler.busy_seconds();
+  }
+}
+
+const char *trace_name(const trace_result *result) {
+  if (result->path == NULL)
+    return "stdin";
+  const char *base = strrchr(result->path, '/');
+  return base ? base + 1 : result->path;
+}
+
+double geomean_rate(const trace_result *results, int num_paths, int t) {
+  double log_sum = 0;
+  int ok = 0;
+  for (int i = 0; i < num_paths; i++) {
+    // A trace with no counted branches has no rate to average
+    if (results[i].error != NULL || results[i].stats[t].num_branches == 0)
+      continue;
+    double rate = sim_rate(results[i].stats[t]);
+    if (rate == 0)
+      return 0;
+    log_sum += log(rate);
+    ok++;
+  }
+  return ok ? exp(log_sum / ok) : 0;
+}
+
+// Width of the trace name column
+//
+static int name_width(const trace_result *results, int num_paths) {
+  int width = 8;
+  for (int i = 0; i < num_paths; i++)
+    width = std::max(width, (int)strlen(trace_name(&results[i])));
+  return width;
+}
+
+void print_results(FILE *out, const trace_result *results, int num_paths,
+                   const predictor_info **types, int num_types) {
+  int width = name_width(results, num_paths);
+  fprintf(out, "%-*s %10s", width, "Trace", "Branches");
+  for (int t = 0; t < num_types; t++)
+    fprintf(out, " %11s", types[t]->name);
+  fprintf(out, " %9s\n", "Time (s)");
+
+  for (int i = 0; i < num_paths; i++) {
+    const trace_result &r = results[i];
+    fprintf(out, "%-*s", width, trace_name(&r));
+    if (r.error != NULL) {
+      fprintf(out, " %s\n", r.error);
+      continue;
+    }
+    fprintf(out, " %10u", r.stats[0].num_branches);
+    for (int t = 0; t < num_types; t++)
+      fprintf(out, " %11.3f", sim_rate(r.stats[t]));
+    fprintf(out, " %9.2f\n", r.seconds);
+  }
+
+  fprintf(out, "%-*s %10s", width, "Geomean", "");
+  for (int t = 0; t < num_types; t++)
+    fprintf(out, " %11.3f", geomean_rate(results, num_paths, t));
+  fprintf(out, "\n");
+}
+
+void print_job_times(FILE *out, const trace_result *results, int num_paths,
+                     const predictor_info **types, int num_types,
+                     const run_summary *summary) {
+  int width = name_width(results, num_paths);
+  fprintf(out, "%-*s %10s", width, "Job (s)", "load");
+  for (int t = 0; t < num_types; t++)
+    fprintf(out, " %11s", types[t]->name);
+  fprintf(out, "\n");
+
+  for (int i = 0; i < num_paths; i++) {
+    const trace_result &r = results[i];
+    fprintf(out, "%-*s %10.2f", width, trace_name(&r), r.load_seconds);
+    if (r.error == NULL) {
+      for (int t = 0; t < num_types; t++)
+        fprintf(out, " %11.2f", r.sim_seconds[t]);
+    }
+    fprintf(out, "\n");
+  }
+
+  fprintf(out, "%d jobs on %d threads in %.2f s, %.0f%% core utilization\n",
+          summary->jobs, summary->threads, summary->wall_seconds,
+          100 * summary->busy_seconds /
+              (summary->wall_seconds * summary->threads));
+}
+
+void free_results(trace_result *results, int num_paths) {
+  for (int i = 0; i < num_paths; i++) {
+    free(results[i].stats);
+    free(results[i].sim_seconds);
+  }
+}
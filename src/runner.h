@@ -0,0 +1,90 @@
+//========================================================//
+//  runner.h                                              //
+//  Header file for the multi-trace runner                //
+//                                                        //
+//  Loads and simulates a list of traces on a pool of     //
+//  threads and reports them together. Each (predictor,   //
+//  trace) pair is its own job, so a long trace is spread //
+//  over every core rather than holding up one            //
+//========================================================//
+
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include "simulate.h"
+
+// Part of every trace to simulate, in records
+typedef struct {
+  uint64_t skip;   // Records passed over before anything else
+  uint64_t warmup; // Records that train but are not counted
+  uint64_t limit;  // Records counted after the warmup, 0 for all
+} sim_window;
+
+typedef struct {
+  const char *path;     // NULL for stdin
+  const char *error;    // NULL if the trace was simulated
+  uint64_t records;     // Records loaded, warmup included
+  double load_seconds;  // Time to load the trace
+  double seconds;       // Time to load and simulate it with every type
+  sim_stats *stats;     // One per predictor type
+  double *sim_seconds;  // Time to simulate each type
+} trace_result;
+
+typedef struct {
+  int threads;
+  int jobs;
+  double wall_seconds; // Time from the first job to the last
+  double busy_seconds; // Time spent in jobs, summed over the threads
+} run_summary;
+
+// Simulates each trace in 'paths' with every one of 'types' on 'threads'
+// threads (0 for one per core). Loading a trace is one job, which queues
+// one job per type once it is done; the biggest traces are loaded first.
+// results[i] receives the outcome for paths[i]; free them with
+// free_results. 'summary' may be NULL.
+//
+void run_traces(const char **paths, int num_paths,
+                const predictor_info **types, int num_types,
+                sim_window window, int threads, trace_result *results,
+                run_summary *summary);
+
+// Simulates the loaded 'trace' with every one of 'types' as 'shards'
+// contiguous intervals of its counted records, all in parallel on 'threads'
+// threads. Each shard starts from a fresh predictor trained on up to
+// 'shard_warmup' records just before it, taken from the preceding shard;
+// the first also gets the usual 'warmup'. stats[t] receives the merged
+// counts of types[t]. If 'sequential' is not NULL, every type is also run
+// over the whole trace, as one more job, into sequential[t]. 'summary' may
+// be NULL.
+//
+void run_shards(const branch_trace &trace, const predictor_info **types,
+                int num_types, uint64_t warmup, int shards,
+                uint64_t shard_warmup, int threads, sim_stats *stats,
+                sim_stats *sequential, run_summary *summary);
+
+// Prints one row per trace with the misprediction rate of each type and
+// the time taken, then the geometric mean rate of each type
+//
+void print_results(FILE *out, const trace_result *results, int num_paths,
+                   const predictor_info **types, int num_types);
+
+// Prints the time of every job, one row per trace, and how busy the
+// threads were overall
+//
+void print_job_times(FILE *out, const trace_result *results, int num_paths,
+                     const predictor_info **types, int num_types,
+                     const run_summary *summary);
+
+// Geometric mean over the simulated traces of the misprediction rate of
+// type 't', leaving out traces with no counted branches; 0 if none is
+// left or a trace had no mispredictions
+//
+double geomean_rate(const trace_result *results, int num_paths, int t);
+
+// Name of the trace for reports: the last component of its path
+//
+const char *trace_name(const trace_result *result);
+
+void free_results(trace_result *results, int num_paths);
+
+#endif
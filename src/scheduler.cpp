@@ -0,0 +1,111 @@
+//========================================================//
+//  scheduler.cpp                                         //
+//  Source file for the work-stealing job scheduler       //
+//========================================================//
+#include "scheduler.h"
+#include <chrono>
+#include <thread>
+#include <time.h>
+
+// Worker running on this thread, -1 outside of JobScheduler::run
+static thread_local int current_worker = -1;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+JobScheduler::JobScheduler(int threads) : pending(0), next(0), completed(0) {
+  if (threads <= 0)
+    threads = (int)std::thread::hardware_concurrency();
+  if (threads < 1)
+    threads = 1;
+  for (int i = 0; i < threads; i++)
+    workers.emplace_back(new Worker);
+  wall = 0;
+}
+
+void JobScheduler::submit(Job job) {
+  int id = current_worker >= 0 ? current_worker
+                               : next.fetch_add(1) % threads();
+  pending++;
+  {
+    std::lock_guard<std::mutex> guard(workers[id]->lock);
+    if (current_worker >= 0)
+      workers[id]->jobs.push_front(std::move(job));
+    else
+      workers[id]->jobs.push_back(std::move(job));
+  }
+  idle.notify_one();
+}
+
+// Pops the front of our own deque, or failing that steals the back of
+// the next worker that has any
+//
+// Returns True if a job was found
+//
+bool JobScheduler::take(int id, Job &job) {
+  for (int i = 0; i < threads(); i++) {
+    Worker &w = *workers[(id + i) % threads()];
+    std::lock_guard<std::mutex> guard(w.lock);
+    if (w.jobs.empty())
+      continue;
+    if (i == 0) {
+      job = std::move(w.jobs.front());
+      w.jobs.pop_front();
+    } else {
+      job = std::move(w.jobs.back());
+      w.jobs.pop_back();
+    }
+    return true;
+  }
+  return false;
+}
+
+void JobScheduler::work(int id) {
+  current_worker = id;
+  Job job;
+  while (pending > 0) {
+    if (!take(id, job)) {
+      // Jobs still running may submit more, so wait rather than leave.
+      // The timeout covers a submit landing between take() and the wait.
+      std::unique_lock<std::mutex> guard(idle_lock);
+      idle.wait_for(guard, std::chrono::milliseconds(1));
+      continue;
+    }
+
+    double start = now();
+    job(id);
+    job = nullptr;
+    workers[id]->busy += now() - start;
+    completed++;
+
+    if (--pending == 0)
+      idle.notify_all();
+  }
+  current_worker = -1;
+}
+
+void JobScheduler::run() {
+  double start = now();
+  completed = 0;
+  for (std::unique_ptr<Worker> &w : workers)
+    w->busy = 0;
+
+  std::vector<std::thread> pool;
+  for (int i = 1; i < threads(); i++)
+    pool.emplace_back(&JobScheduler::work, this, i);
+  work(0);
+  for (std::thread &t : pool)
+    t.join();
+
+  wall = now() - start;
+}
+
+double JobScheduler::busy_seconds() const {
+  double busy = 0;
+  for (const std::unique_ptr<Worker> &w : workers)
+    busy += w->busy;
+  return busy;
+}
@@ -0,0 +1,68 @@
+//========================================================//
+//  scheduler.h                                           //
+//  Header file for the work-stealing job scheduler       //
+//                                                        //
+//  Every worker owns a deque of jobs. It runs its own    //
+//  newest job first and, once out of work, steals the    //
+//  oldest job of another worker                          //
+//========================================================//
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class JobScheduler {
+public:
+  // A job is passed the index of the worker running it
+  typedef std::function<void(int worker)> Job;
+
+  // 'threads' workers, 0 for one per core; the thread calling run() is
+  // one of them
+  explicit JobScheduler(int threads);
+
+  // Queues 'job'. From inside a running job it goes to the front of that
+  // worker's own deque, so a job's follow-up work runs next on the same
+  // core unless another worker steals it; otherwise jobs are dealt out
+  // round robin.
+  void submit(Job job);
+
+  // Runs queued jobs, and any they submit, until there are none left
+  void run();
+
+  int threads() const { return (int)workers.size(); }
+  int jobs_run() const { return completed; }
+
+  // Wall clock time of the last run() and the time its workers spent
+  // running jobs; busy / (wall * threads) is the core utilization
+  double wall_seconds() const { return wall; }
+  double busy_seconds() const;
+
+private:
+  struct Worker {
+    std::mutex lock;
+    std::deque<Job> jobs;
+    double busy = 0;
+  };
+
+  void work(int id);
+  bool take(int id, Job &job);
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<int> pending; // Submitted but not yet finished
+  std::atomic<int> next;    // Round robin target for outside submits
+  std::atomic<int> completed;
+  double wall;
+
+  // Idle workers sleep here until a submit or the end of the run
+  std::mutex idle_lock;
+  std::condition_variable idle;
+};
+
+#endif
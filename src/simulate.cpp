@@ -0,0 +1,42 @@
+//========================================================//
+//  simulate.cpp                                          //
+//  Source file for the simulation outputs                //
+//========================================================//
+#include "simulate.h"
+
+void sim_output_word(const sim_output *output, const branch_trace &trace,
+                     uint64_t first, uint64_t counted, uint64_t predictions,
+                     uint64_t taken, uint64_t providers) {
+  // Gather the counted predictions at the bottom of one word
+  uint64_t packed = 0;
+  int n = 0;
+  for (uint64_t m = counted; m; m &= m - 1) {
+    uint64_t bit = (predictions >> __builtin_ctzll(m)) & 1;
+    if (output->verbose != 0)
+      printf("%d\n", (int)bit);
+    packed |= bit << n++;
+  }
+
+  if (output->predictions != NULL)
+    pred_writer_put(output->predictions, packed, n);
+
+  if (output->profile != NULL) {
+    uint64_t missed = (predictions ^ taken) & counted;
+    for (uint64_t m = counted; m; m &= m - 1) {
+      int j = __builtin_ctzll(m);
+      pc_stats *branch = &output->profile[trace.pcid[first + j]];
+      branch->executions++;
+      branch->mispredicts += (missed >> j) & 1;
+      branch->taken += (taken >> j) & 1;
+    }
+  }
+
+  if (output->mispredicts != NULL) {
+    for (uint64_t m = (predictions ^ taken) & counted; m; m &= m - 1) {
+      int j = __builtin_ctzll(m);
+      miss_writer_put(output->mispredicts, output->first + first + j,
+                      trace.pc[first + j], trace.target[first + j],
+                      (taken >> j) & 1, (providers >> j) & 1);
+    }
+  }
+}
@@ -0,0 +1,154 @@
+//========================================================//
+//  simulate.h                                            //
+//  Header file for the simulation loop and the registry  //
+//  of predictor types                                    //
+//                                                        //
+//  Each registered type gets its own copy of the loop,   //
+//  so the calls into the predictor are resolved at       //
+//  compile time and can be inlined                       //
+//========================================================//
+
+#ifndef SIMULATE_H
+#define SIMULATE_H
+
+#include "predictor.h"
+#include "predstream.h"
+#include "trace.h"
+#include <stdio.h>
+
+//------------------------------------//
+//          Simulation Loop           //
+//------------------------------------//
+
+typedef struct {
+  uint32_t num_branches;
+  uint32_t mispredictions;
+} sim_stats;
+
+// Mispredictions per 1000 counted branches, 0 if none were counted
+//
+static inline double sim_rate(const sim_stats &stats) {
+  return stats.num_branches ? 1000.0 * stats.mispredictions / stats.num_branches
+                            : 0;
+}
+
+// Counts of one static branch, indexed by the pcid of the trace
+typedef struct {
+  uint64_t executions;  // Counted executions
+  uint64_t mispredicts; // Of which mispredicted
+  uint64_t taken;       // Of which taken
+} pc_stats;
+
+// Where the individual predictions of a run go, besides the counts
+typedef struct {
+  int verbose;              // Print each counted prediction on stdout
+  pred_writer *predictions; // Append each counted prediction, or NULL
+  miss_writer *mispredicts; // Log each counted misprediction, or NULL
+  pc_stats *profile;        // Add up each counted branch by pcid, or NULL
+  uint64_t first;           // Index of the first simulated record in the
+                            // whole trace, for the log
+} sim_output;
+
+// Hands records first..first+63 of 'trace' to 'output'. Bit j of 'counted'
+// is set if record first + j is a counted conditional branch, of
+// 'predictions' if it was predicted taken, of 'taken' if it was taken and
+// of 'providers' if the prediction came from component 1.
+//
+void sim_output_word(const sim_output *output, const branch_trace &trace,
+                     uint64_t first, uint64_t counted, uint64_t predictions,
+                     uint64_t taken, uint64_t providers);
+
+// Records handed to the predictor per predict_batch call
+#define SIMULATE_BATCH 4096
+
+// Runs 'predictor' over every record of 'trace'. The first 'warmup'
+// records only train it. Unless 'output' is NULL the counted predictions
+// also go there.
+//
+template <class P>
+sim_stats simulate(P &predictor, const branch_trace &trace, uint64_t warmup,
+                   const sim_output *output) {
+  sim_stats stats = {0, 0};
+  uint64_t predictions[SIMULATE_BATCH / 64];
+  uint64_t providers[SIMULATE_BATCH / 64];
+  uint64_t *from =
+      output != NULL && output->mispredicts != NULL ? providers : NULL;
+
+  // Reach each batch of branches from the trace
+  for (uint64_t base = 0; base < trace.count; base += SIMULATE_BATCH) {
+    uint64_t count = trace.count - base < SIMULATE_BATCH ? trace.count - base
+                                                         : SIMULATE_BATCH;
+    predictor.predict_batch(trace_slice(trace, base, count), predictions,
+                            from);
+
+    // Compare each word of predictions with the actual outcomes
+    for (uint64_t w = 0; w * 64 < count; w++) {
+      uint64_t first = base + w * 64;
+      uint64_t n = count - w * 64 < 64 ? count - w * 64 : 64;
+      uint64_t counted = flag_mask(trace.flags + first, n, TRACE_CONDITION);
+      uint64_t taken = flag_mask(trace.flags + first, n,
+                                 TRACE_CONDITION | TRACE_OUTCOME);
+      if (first + n <= warmup)
+        counted = 0;
+      else if (first < warmup)
+        counted &= ~0ull << (warmup - first);
+
+      stats.num_branches += __builtin_popcountll(counted);
+      stats.mispredictions +=
+          __builtin_popcountll((predictions[w] ^ taken) & counted);
+      if (output != NULL)
+        sim_output_word(output, trace, first, counted, predictions[w], taken,
+                        from != NULL ? from[w] : 0);
+    }
+  }
+
+  return stats;
+}
+
+//------------------------------------//
+//        Predictor Registry          //
+//------------------------------------//
+
+typedef Predictor *(*predictor_factory)();
+typedef sim_stats (*predictor_runner)(Predictor *predictor,
+                                      const branch_trace &trace,
+                                      uint64_t warmup,
+                                      const sim_output *output);
+
+typedef struct {
+  const char *name;         // Selected with --<name>
+  predictor_factory create; // Returns a new instance
+  predictor_runner run;     // simulate() for instances of this type
+} predictor_info;
+
+// Adds a predictor type, see REGISTER_PREDICTOR
+//
+// Returns True if Successful
+//
+int register_predictor(const char *name, predictor_factory create,
+                       predictor_runner run);
+
+// Returns the registered type called 'name', or NULL
+//
+const predictor_info *find_predictor(const char *name);
+
+// Registered types, in registration order
+//
+int num_predictors();
+const predictor_info *predictor_at(int i);
+
+// Registers 'Class' as --<name>, constructed with the remaining arguments,
+// and checks at compile time that it fits the hardware budget. Use it at
+// file scope, with a typedef for template instances.
+#define REGISTER_PREDICTOR(name, Class, ...)                                 \
+  static_assert(fits_budget(Class::budget_bits()),                           \
+                #Class " exceeds the hardware budget");                      \
+  static const int registered_##Class = register_predictor(                  \
+      name, []() -> Predictor * { return new Class(__VA_ARGS__); },          \
+      [](Predictor *predictor, const branch_trace &trace, uint64_t warmup,   \
+         const sim_output *output) {                                         \
+        return simulate(*static_cast<Class *>(predictor), trace, warmup,     \
+                        output);                                             \
+      })
+
+#endif
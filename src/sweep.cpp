@@ -0,0 +1,124 @@
+//========================================================//
+//  sweep.cpp                                             //
+//  Source file for parameter sweeps                      //
+//                                                        //
+//  Grid:                                                 //
+//    gshare      ghist 8..15                             //
+//    tournament  ghist 10..14 x chooser 10..14           //
+//    custom      ghist 10..14 x chooser 10..14           //
+//  with the other widths as in TournamentPredictor and   //
+//  CustomPredictor                                       //
+//========================================================//
+#include "sweep.h"
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+typedef struct {
+  std::vector<sweep_config> configs;
+  std::vector<sweep_config> over_budget; // Without an 'info'
+} sweep_grid;
+
+// Calls f(std::integral_constant<int, i>()) for each i in Lo..Hi
+//
+template <int Lo, class F, int... I>
+static void for_range(F f, std::integer_sequence<int, I...>) {
+  (f(std::integral_constant<int, Lo + I>()), ...);
+}
+
+template <int Lo, int Hi, class F> static void for_range(F f) {
+  for_range<Lo>(f, std::make_integer_sequence<int, Hi - Lo + 1>());
+}
+
+// Adds 'P' to the grid, unless it is over the budget, in which case its
+// simulation loop is never instantiated
+//
+template <class P>
+static void add_config(sweep_grid &grid, const char *family, int ghist,
+                       int chooser) {
+  if constexpr (fits_budget(P::budget_bits())) {
+    char name[48];
+    if (chooser)
+      snprintf(name, sizeof(name), "%s-%d-%d", family, ghist, chooser);
+    else
+      snprintf(name, sizeof(name), "%s-%d", family, ghist);
+    grid.configs.push_back(
+        {family, ghist, chooser, P::budget_bits(),
+         {strdup(name), []() -> Predictor * { return new P(); },
+          [](Predictor *predictor, const branch_trace &trace, uint64_t warmup,
+             const sim_output *output) {
+            return simulate(*static_cast<P *>(predictor), trace, warmup,
+                            output);
+          }}});
+  } else {
+    grid.over_budget.push_back(
+        {family, ghist, chooser, P::budget_bits(), {NULL, NULL, NULL}});
+  }
+}
+
+static const sweep_grid &grid() {
+  static const sweep_grid points = []() {
+    sweep_grid grid = {{}, {}};
+    for_range<8, 15>([&](auto h) {
+      add_config<GsharePredictor<decltype(h)::value>>(grid, "gshare",
+                                                      decltype(h)::value, 0);
+    });
+    for_range<10, 14>([&](auto g) {
+      for_range<10, 14>([&](auto c) {
+        constexpr int G = decltype(g)::value, C = decltype(c)::value;
+        add_config<HybridPredictor<11, 11, G, C, false>>(grid, "tournament",
+                                                         G, C);
+      });
+    });
+    for_range<10, 14>([&](auto g) {
+      for_range<10, 14>([&](auto c) {
+        constexpr int G = decltype(g)::value, C = decltype(c)::value;
+        add_config<HybridPredictor<10, 11, G, C, true>>(grid, "custom", G, C);
+      });
+    });
+    return grid;
+  }();
+  return points;
+}
+
+int num_sweep_configs() { return (int)grid().configs.size(); }
+
+const sweep_config *sweep_config_at(int i) { return &grid().configs[i]; }
+
+int num_sweep_over_budget() { return (int)grid().over_budget.size(); }
+
+const sweep_config *sweep_over_budget_at(int i) {
+  return &grid().over_budget[i];
+}
+
+int sweep_has_family(const char *family) {
+  for (const sweep_config &config : grid().configs)
+    if (!strcmp(config.family, family))
+      return 1;
+  return 0;
+}
+
+void print_sweep_csv(FILE *out, const sweep_config **configs,
+                     int num_configs, const trace_result *results,
+                     int num_paths) {
+  fprintf(out, "trace,family,ghist,chooser,budget_bits,branches,"
+               "mispredictions,mispredict_rate,seconds\n");
+  for (int c = 0; c < num_configs; c++) {
+    const sweep_config *config = configs[c];
+    for (int i = 0; i < num_paths; i++) {
+      const trace_result &r = results[i];
+      if (r.error != NULL)
+        continue;
+      fprintf(out, "%s,%s,%d,", trace_name(&r), config->family,
+              config->ghist);
+      if (config->chooser)
+        fprintf(out, "%d", config->chooser);
+      fprintf(out, ",%llu,%u,%u,%.3f,%.3f\n",
+              (unsigned long long)config->budget_bits,
+              r.stats[c].num_branches, r.stats[c].mispredictions,
+              sim_rate(r.stats[c]),
+              r.sim_seconds[c]);
+    }
+  }
+}
@@ -0,0 +1,49 @@
+//========================================================//
+//  sweep.h                                               //
+//  Header file for parameter sweeps                      //
+//                                                        //
+//  The grid is instantiated at compile time, one class   //
+//  per point, and points over the hardware budget are    //
+//  dropped before they are ever built                    //
+//========================================================//
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "runner.h"
+#include "simulate.h"
+#include <stdio.h>
+
+// One point of the grid. 'info' names it "<family>-<ghist>[-<chooser>]"
+// and runs it like any registered type.
+typedef struct {
+  const char *family;   // "gshare", "tournament" or "custom"
+  int ghist;            // Global history bits
+  int chooser;          // Chooser index bits, 0 for gshare
+  uint64_t budget_bits; // Storage modeled by this configuration
+  predictor_info info;
+} sweep_config;
+
+// Every point of the grid that fits the budget, family by family
+//
+int num_sweep_configs();
+const sweep_config *sweep_config_at(int i);
+
+// Points of the grid dropped for exceeding the budget, as configurations
+// without an 'info'
+//
+int num_sweep_over_budget();
+const sweep_config *sweep_over_budget_at(int i);
+
+// Returns True if 'family' has points in the grid
+//
+int sweep_has_family(const char *family);
+
+// Writes a header line and one CSV row per configuration and trace, as
+// simulated by run_traces with configs[c]->info as type c
+//
+void print_sweep_csv(FILE *out, const sweep_config **configs,
+                     int num_configs, const trace_result *results,
+                     int num_paths);
+
+#endif
@@ -0,0 +1,1069 @@
+//========================================================//
+//  trace.cpp                                             //
+//  Source file for the branch trace readers              //
+//                                                        //
+//  Detects the trace format from its first bytes and     //
+//  decodes text, binary or delta coded records, either   //
+//  from a stdio stream or straight out of a memory       //
+//  mapped file                                           //
+//========================================================//
+#include "trace.h"
+#include "bzsource.h"
+#include "tracecache.h"
+#include <fcntl.h>
+#include <immintrin.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TRACE_CHUNK_RECORDS 4096
+
+int trace_use_simd = 1;
+
+// Entries in each of the delta coder's prediction tables
+#define DELTA_TABLE_BITS 12
+
+// Mask of the TRACE_* bits in a delta record's flags byte
+#define DELTA_FLAG_BITS 0x1f
+
+// Longest delta record: the flags byte and two 5 byte varints
+#define DELTA_RECORD_MAX 11
+
+enum trace_format { FORMAT_TEXT, FORMAT_BINARY, FORMAT_DELTA };
+
+// What the delta coder predicts each record from. Reset at the start of
+// every block so blocks decode on their own.
+struct delta_tables {
+  uint32_t prev_pc;
+  uint32_t next_pc[1 << DELTA_TABLE_BITS]; // pc that followed a pc
+  uint32_t target[1 << DELTA_TABLE_BITS];  // last target of a pc
+};
+
+struct trace_reader {
+  FILE *stream;
+  trace_format format;
+
+  // Text state
+  char *line;
+  size_t line_len;
+
+  // Binary state, records are read TRACE_CHUNK_RECORDS at a time
+  uint8_t chunk[TRACE_CHUNK_RECORDS * TRACE_RECORD_SIZE];
+  size_t chunk_pos;
+  size_t chunk_end;
+
+  // Mapped state, 'stream' is NULL when these are in use
+  uint8_t *map;
+  size_t map_len;
+  const uint8_t *cursor;
+  const uint8_t *end;
+  const uint8_t *data; // first record, for seeking
+  uint64_t pos;        // index of the next record
+
+  // Delta state, 'end' is the start of the block index
+  uint64_t count;
+  uint32_t block_records;
+  const uint8_t *index;
+  delta_tables *delta;
+
+  // For .bz2 files cursor and end walk the chunks handed out by 'bz'
+  // instead of the mapping itself
+  bz_source *bz;
+
+  // Mapped text is tokenized with AVX2 when available
+  int simd;
+
+  // Opened from the decoded cache entry of a .bz2
+  int cached;
+
+  // Records decoded from a .bz2 are also written to a new cache entry,
+  // which is kept only if the whole trace was read
+  FILE *cache_out;
+  char *cache_tmp;
+  char *cache_path;
+  uint64_t cache_count;
+  int cache_done;
+};
+
+static inline uint32_t load_u32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v)); // traces are little endian, as is the host
+  return v;
+}
+
+static inline void store_u32(uint8_t *p, uint32_t v) {
+  memcpy(p, &v, sizeof(v));
+}
+
+static inline uint64_t load_u64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+//------------------------------------//
+//          Delta Record Coder        //
+//------------------------------------//
+
+static inline uint32_t delta_hash(uint32_t pc) {
+  return (pc * 0x9E3779B1u) >> (32 - DELTA_TABLE_BITS);
+}
+
+static inline uint32_t zigzag(uint32_t d) {
+  return (d << 1) ^ (uint32_t)((int32_t)d >> 31);
+}
+
+static inline uint32_t unzigzag(uint32_t z) { return (z >> 1) ^ -(z & 1); }
+
+static inline uint8_t *put_varint(uint8_t *p, uint32_t v) {
+  while (v >= 0x80) {
+    *p++ = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+// Reads at most 5 bytes, enough for any 32-bit value
+//
+static inline const uint8_t *get_varint(const uint8_t *p, uint32_t *v) {
+  uint32_t x = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    uint8_t b = *p++;
+    x |= (uint32_t)(b & 0x7f) << shift;
+    if (b < 0x80)
+      break;
+  }
+  *v = x;
+  return p;
+}
+
+// Encodes one record at 'p', at most 11 bytes
+//
+// Returns the end of the record
+//
+static inline uint8_t *delta_encode(uint8_t *p, delta_tables *t, uint32_t pc,
+                                    uint32_t target, uint8_t flags) {
+  uint8_t *f = p++;
+  flags &= DELTA_FLAG_BITS;
+
+  uint32_t *next = &t->next_pc[delta_hash(t->prev_pc)];
+  if (*next == pc)
+    flags |= TRACE_PC_HIT;
+  else
+    p = put_varint(p, zigzag(pc - t->prev_pc));
+  *next = pc;
+  t->prev_pc = pc;
+
+  uint32_t *last = &t->target[delta_hash(pc)];
+  if (*last == target)
+    flags |= TRACE_TARGET_HIT;
+  else
+    p = put_varint(p, zigzag(target - pc));
+  *last = target;
+
+  *f = flags;
+  return p;
+}
+
+// Decodes the record at 'p'
+//
+// Returns the start of the next record
+//
+static inline const uint8_t *delta_decode(const uint8_t *p, delta_tables *t,
+                                          uint32_t *pc, uint32_t *target,
+                                          uint8_t *flags) {
+  uint8_t f = *p++;
+  uint32_t z;
+
+  uint32_t *next = &t->next_pc[delta_hash(t->prev_pc)];
+  if (!(f & TRACE_PC_HIT)) {
+    p = get_varint(p, &z);
+    *next = t->prev_pc + unzigzag(z);
+  }
+  uint32_t v = *next;
+  t->prev_pc = v;
+  *pc = v;
+
+  uint32_t *last = &t->target[delta_hash(v)];
+  if (!(f & TRACE_TARGET_HIT)) {
+    p = get_varint(p, &z);
+    *last = v + unzigzag(z);
+  }
+  *target = *last;
+
+  *flags = f & DELTA_FLAG_BITS;
+  return p;
+}
+
+//------------------------------------//
+//          Text Record Parser        //
+//------------------------------------//
+
+// Digit values for hex parsing, -1 for anything that ends a field
+struct hex_table_t {
+  int8_t v[256];
+  constexpr hex_table_t() : v() {
+    for (int c = 0; c < 256; c++)
+      v[c] = (c >= '0' && c <= '9')   ? c - '0'
+             : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+             : (c >= 'A' && c <= 'F') ? c - 'A' + 10
+                                      : -1;
+  }
+};
+static constexpr hex_table_t hex_table;
+
+static inline const char *parse_hex(const char *p, uint32_t *out) {
+  if (p[0] == '0' && (p[1] | 0x20) == 'x')
+    p += 2;
+  uint32_t v = 0;
+  int d;
+  while ((d = hex_table.v[(uint8_t)*p]) >= 0) {
+    v = (v << 4) | (uint32_t)d;
+    p++;
+  }
+  *out = v;
+  return p;
+}
+
+static inline const char *parse_dec(const char *p, uint32_t *out) {
+  uint32_t v = 0;
+  uint32_t d;
+  while ((d = (uint32_t)(uint8_t)*p - '0') < 10) {
+    v = v * 10 + d;
+    p++;
+  }
+  *out = v;
+  return p;
+}
+
+// Parses one "0x<pc>\t0x<target>\t<o>\t<c>\t<call>\t<ret>\t<direct>" line.
+// 'p' must be NUL terminated somewhere after the line, which the getline
+// buffer and the mapped reader (see map_file) both guarantee.
+//
+// Returns a pointer just past the line's newline
+//
+static const char *parse_line(const char *p, uint32_t *pc, uint32_t *target,
+                              uint32_t *outcome, uint32_t *condition,
+                              uint32_t *call, uint32_t *ret,
+                              uint32_t *direct) {
+  p = parse_hex(p, pc);
+  p = parse_hex(p + (*p == '\t'), target);
+  p = parse_dec(p + (*p == '\t'), outcome);
+  p = parse_dec(p + (*p == '\t'), condition);
+  p = parse_dec(p + (*p == '\t'), call);
+  p = parse_dec(p + (*p == '\t'), ret);
+  p = parse_dec(p + (*p == '\t'), direct);
+
+  while (*p != '\n' && *p != '\0')
+    p++;
+  return p + (*p == '\n');
+}
+
+// Shuffle control that right aligns the 'n' bytes ending just before
+// 'end' into the low 8 bytes of a lane, zeroing everything else
+//
+__attribute__((target("avx2"))) static inline __m128i align_field(unsigned end,
+                                                                  unsigned n) {
+  const __m128i iota =
+      _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  __m128i idx = _mm_add_epi8(iota, _mm_set1_epi8((char)(end - 8)));
+  __m128i keep = _mm_and_si128(_mm_cmpgt_epi8(iota, _mm_set1_epi8(7 - n)),
+                               _mm_cmpgt_epi8(_mm_set1_epi8(8), iota));
+  return _mm_or_si128(idx, _mm_andnot_si128(keep, _mm_set1_epi8(-128)));
+}
+
+// AVX2 version of parse_line. One 32 byte load classifies the line: the
+// tab/newline/NUL mask locates both hex fields and, with the mask of
+// decimal digits, checks that the five flags are single digits. Both hex
+// fields are then shuffled into one register and converted together with
+// vector arithmetic, as are the flags. Lines of any other shape (longer
+// than 32 bytes, hex fields wider than 8 digits, flags that are not one
+// digit) go to the scalar parser. 'p' must be readable for TRACE_PAD
+// bytes.
+//
+__attribute__((target("avx2,bmi,bmi2"))) static const char *
+parse_line_avx2(const char *p, uint32_t *pc, uint32_t *target,
+                uint32_t *outcome, uint32_t *condition, uint32_t *call,
+                uint32_t *ret, uint32_t *direct) {
+  const __m256i v = _mm256_loadu_si256((const __m256i *)p);
+  const __m256i delim = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')),
+                      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))),
+      _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+  uint32_t m = (uint32_t)_mm256_movemask_epi8(delim);
+
+  // Bytes of 0..9 once '0' is subtracted are decimal digits
+  const __m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+  uint32_t digits = (uint32_t)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d));
+
+  // The hex fields end at t0 and t1; after t1 the delimiters must sit at
+  // every second byte (bits 2,4,6,8,10 = 0x554) up to the end of the line,
+  // with a digit at each byte between them (bits 1,3,5,7,9 = 0x2AA)
+  unsigned t0 = _tzcnt_u32(m);
+  uint32_t rest = _blsr_u32(m);
+  unsigned t1 = _tzcnt_u32(rest);
+  unsigned n_pc = t0 - 2;
+  unsigned n_target = t1 - t0 - 3;
+  if (t1 > 21 || t0 < 2 || t1 < t0 + 3 || n_pc > 8 || n_target > 8 ||
+      _bzhi_u32(rest, t1 + 11) != ((1u | 0x554u) << t1) ||
+      ((digits >> t1) & 0x2AAu) != 0x2AAu ||
+      p[t1 + 10] == '\t' || p[0] != '0' || (p[1] | 0x20) != 'x' ||
+      p[t0 + 1] != '0' || (p[t0 + 2] | 0x20) != 'x')
+    return parse_line(p, pc, target, outcome, condition, call, ret, direct);
+
+  // Right align the pc digits in the low lane and the target digits
+  // (reloaded from their own start) in the high lane
+  __m256i fields = _mm256_set_m128i(
+      _mm_loadu_si128((const __m128i *)(p + t0 + 3)),
+      _mm256_castsi256_si128(v));
+  fields = _mm256_shuffle_epi8(fields,
+                               _mm256_set_m128i(align_field(n_target, n_target),
+                                                align_field(t0, n_pc)));
+  __m128i x = _mm_unpacklo_epi64(_mm256_castsi256_si128(fields),
+                                 _mm256_extracti128_si256(fields, 1));
+
+  // Nibble value of every byte: low four bits, plus 9 for letters (which
+  // have bit 6 set); the zeroed padding stays 0
+  __m128i letter = _mm_cmpeq_epi8(_mm_and_si128(x, _mm_set1_epi8(0x40)),
+                                  _mm_set1_epi8(0x40));
+  x = _mm_add_epi8(_mm_and_si128(x, _mm_set1_epi8(0x0F)),
+                   _mm_and_si128(letter, _mm_set1_epi8(9)));
+
+  // Pairs of nibbles become bytes (hi*16+lo), pack to 4 bytes per field
+  // and reverse them into little endian words
+  x = _mm_maddubs_epi16(x, _mm_set1_epi16(0x0110));
+  x = _mm_packus_epi16(x, x);
+  x = _mm_shuffle_epi8(x, _mm_set_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 4, 5,
+                                       6, 7, 0, 1, 2, 3));
+  *pc = (uint32_t)_mm_cvtsi128_si32(x);
+  *target = (uint32_t)_mm_extract_epi32(x, 1);
+
+  // The flag digits (reloaded from the first) widen to one per word
+  const char *f = p + t1 + 1;
+  __m128i flags = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)f),
+                               _mm_set1_epi8('0'));
+  __m128i words = _mm_shuffle_epi8(
+      flags, _mm_setr_epi8(0, -1, -1, -1, 2, -1, -1, -1, 4, -1, -1, -1, 6, -1,
+                           -1, -1));
+  *outcome = (uint32_t)_mm_cvtsi128_si32(words);
+  *condition = (uint32_t)_mm_extract_epi32(words, 1);
+  *call = (uint32_t)_mm_extract_epi32(words, 2);
+  *ret = (uint32_t)_mm_extract_epi32(words, 3);
+  *direct = (uint32_t)_mm_extract_epi8(flags, 8);
+
+  return f + 9 + (f[9] == '\n');
+}
+
+//------------------------------------//
+//           Trace Reader             //
+//------------------------------------//
+
+trace_reader *trace_open(FILE *stream) {
+  if (stream == NULL)
+    return NULL;
+
+  trace_reader *reader = (trace_reader *)calloc(1, sizeof(trace_reader));
+  reader->stream = stream;
+  reader->format = FORMAT_TEXT;
+
+  // Text traces always begin with "0x", so a leading magic byte is enough
+  // to tell the formats apart without having to seek back
+  int c = getc(stream);
+  if (c != EOF)
+    ungetc(c, stream);
+
+  if (c == TRACE_MAGIC[0]) {
+    uint8_t header[TRACE_HEADER_SIZE];
+    if (fread(header, 1, TRACE_HEADER_SIZE, stream) != TRACE_HEADER_SIZE ||
+        memcmp(header, TRACE_MAGIC, TRACE_MAGIC_LEN)) {
+      free(reader);
+      return NULL;
+    }
+    reader->format = FORMAT_BINARY;
+  }
+
+  return reader;
+}
+
+// Maps 'size' bytes of 'fd' followed by at least TRACE_PAD zero bytes, so
+// the text parser can always rely on a NUL after the last line
+//
+static uint8_t *map_file(int fd, size_t size, size_t *map_len) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t len = (size + TRACE_PAD + page - 1) & ~(page - 1);
+
+  void *base = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED)
+    return NULL;
+  if (mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) ==
+      MAP_FAILED) {
+    munmap(base, len);
+    return NULL;
+  }
+
+  madvise(base, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+  madvise(base, size, MADV_HUGEPAGE);
+#endif
+
+  *map_len = len;
+  return (uint8_t *)base;
+}
+
+// Checks the header and block index of the mapped delta trace at the
+// reader's cursor
+//
+// Returns True if they are consistent
+//
+static int open_delta(trace_reader *reader) {
+  const uint8_t *h = reader->cursor;
+  size_t size = (size_t)(reader->end - h);
+  if (size < TRACE_DELTA_HEADER_SIZE + 16)
+    return 0;
+
+  uint64_t count = load_u64(h + TRACE_MAGIC_LEN);
+  uint32_t block_records = load_u32(h + TRACE_MAGIC_LEN + 8);
+  const uint8_t *tail = reader->end - 16;
+  if (block_records == 0 ||
+      memcmp(tail + 8, TRACE_DELTA_INDEX_MAGIC, TRACE_MAGIC_LEN))
+    return 0;
+
+  uint64_t blocks = load_u64(tail);
+  if (blocks != (count + block_records - 1) / block_records ||
+      blocks > (uint64_t)(tail - h - TRACE_DELTA_HEADER_SIZE) / 8)
+    return 0;
+
+  const uint8_t *index = tail - blocks * 8;
+  uint64_t prev = TRACE_DELTA_HEADER_SIZE;
+  for (uint64_t b = 0; b < blocks; b++) {
+    uint64_t offset = load_u64(index + b * 8);
+    if (offset < prev || offset > (uint64_t)(index - h))
+      return 0;
+    prev = offset;
+  }
+
+  reader->format = FORMAT_DELTA;
+  reader->data = h;
+  reader->count = count;
+  reader->block_records = block_records;
+  reader->index = index;
+  reader->end = index;
+  reader->delta = (delta_tables *)malloc(sizeof(delta_tables));
+  return 1;
+}
+
+trace_reader *trace_open_path(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  // Pipes, fifos and empty files go through stdio
+  struct stat st;
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return trace_open(fopen(path, "rb"));
+  }
+
+  size_t map_len;
+  uint8_t *map = map_file(fd, (size_t)st.st_size, &map_len);
+  close(fd);
+  if (map == NULL)
+    return trace_open(fopen(path, "rb"));
+
+  int bzip2 = bz_is_bzip2(map, (size_t)st.st_size);
+  char *cache_path = NULL;
+  if (bzip2 && (cache_path = trace_cache_path(map, (size_t)st.st_size))) {
+    // Use the decoded copy from an earlier run if there is one
+    if (trace_cache_touch(cache_path)) {
+      trace_reader *cached = trace_open_path(cache_path);
+      if (cached != NULL) {
+        cached->cached = 1;
+        free(cache_path);
+        munmap(map, map_len);
+        return cached;
+      }
+      unlink(cache_path);
+    }
+  }
+
+  trace_reader *reader = (trace_reader *)calloc(1, sizeof(trace_reader));
+  reader->map = map;
+  reader->map_len = map_len;
+  reader->cursor = map;
+  reader->end = map + st.st_size;
+  reader->format = FORMAT_TEXT;
+
+  if (bzip2) {
+    // Decompress on a producer thread and parse the first chunk to learn
+    // the format of the trace inside
+    size_t len = 0;
+    reader->bz = bz_source_start(map, (size_t)st.st_size);
+    bz_source_next(reader->bz, &reader->cursor, &len);
+    reader->end = reader->cursor + len;
+
+    if (cache_path != NULL) {
+      reader->cache_path = cache_path;
+      reader->cache_out = trace_cache_create(cache_path, &reader->cache_tmp);
+    }
+  }
+
+  size_t size = (size_t)(reader->end - reader->cursor);
+  if (size > 0 && reader->cursor[0] == TRACE_MAGIC[0]) {
+    if (size >= TRACE_MAGIC_LEN &&
+        !memcmp(reader->cursor, TRACE_DELTA_MAGIC, TRACE_MAGIC_LEN)) {
+      // The block index sits at the end, so the whole file is needed
+      if (bzip2 || !open_delta(reader)) {
+        trace_close(reader);
+        return NULL;
+      }
+    } else if (size < TRACE_HEADER_SIZE ||
+               memcmp(reader->cursor, TRACE_MAGIC, TRACE_MAGIC_LEN)) {
+      trace_close(reader);
+      return NULL;
+    } else {
+      reader->format = FORMAT_BINARY;
+      reader->cursor += TRACE_HEADER_SIZE;
+      // Ignore a truncated trailing record
+      reader->end -= (reader->end - reader->cursor) % TRACE_RECORD_SIZE;
+    }
+  }
+  reader->data = reader->cursor;
+
+  __builtin_cpu_init();
+  reader->simd = trace_use_simd && __builtin_cpu_supports("avx2") &&
+                 __builtin_cpu_supports("bmi") &&
+                 __builtin_cpu_supports("bmi2");
+
+  return reader;
+}
+
+static inline void unpack_flags(uint8_t flags, uint32_t *outcome,
+                                uint32_t *condition, uint32_t *call,
+                                uint32_t *ret, uint32_t *direct) {
+  *outcome = (flags & TRACE_OUTCOME) != 0;
+  *condition = (flags & TRACE_CONDITION) != 0;
+  *call = (flags & TRACE_CALL) != 0;
+  *ret = (flags & TRACE_RET) != 0;
+  *direct = (flags & TRACE_DIRECT) != 0;
+}
+
+static int read_text(trace_reader *reader, uint32_t *pc, uint32_t *target,
+                     uint32_t *outcome, uint32_t *condition, uint32_t *call,
+                     uint32_t *ret, uint32_t *direct) {
+  if (getline(&reader->line, &reader->line_len, reader->stream) == -1)
+    return 0;
+
+  parse_line(reader->line, pc, target, outcome, condition, call, ret, direct);
+
+  return 1;
+}
+
+static int read_binary(trace_reader *reader, uint32_t *pc, uint32_t *target,
+                       uint32_t *outcome, uint32_t *condition, uint32_t *call,
+                       uint32_t *ret, uint32_t *direct) {
+  if (reader->chunk_pos == reader->chunk_end) {
+    size_t n = fread(reader->chunk, TRACE_RECORD_SIZE, TRACE_CHUNK_RECORDS,
+                     reader->stream);
+    if (n == 0)
+      return 0;
+    reader->chunk_pos = 0;
+    reader->chunk_end = n * TRACE_RECORD_SIZE;
+  }
+
+  const uint8_t *rec = reader->chunk + reader->chunk_pos;
+  reader->chunk_pos += TRACE_RECORD_SIZE;
+
+  *pc = load_u32(rec);
+  *target = load_u32(rec + 4);
+  unpack_flags(rec[8], outcome, condition, call, ret, direct);
+
+  return 1;
+}
+
+// Moves on to the next decompressed chunk
+//
+// Returns False at the end of the trace
+//
+static int next_chunk(trace_reader *reader) {
+  size_t len;
+  if (reader->bz == NULL || !bz_source_next(reader->bz, &reader->cursor, &len)) {
+    if (reader->bz != NULL && bz_source_error(reader->bz))
+      fprintf(stderr, "Warning: bzip2 trace is corrupt or truncated\n");
+    // Stay at the end, the cursor may now point into the end marker
+    reader->end = reader->cursor;
+    return 0;
+  }
+  reader->end = reader->cursor + len;
+  return 1;
+}
+
+// Moves to the start of delta block 'block'
+//
+static void delta_block(trace_reader *reader, uint64_t block) {
+  reader->cursor = reader->data + load_u64(reader->index + block * 8);
+  memset(reader->delta, 0, sizeof(delta_tables));
+}
+
+// Decodes the next delta record into 'pc', 'target' and 'flags'
+//
+// Returns False at the end of the trace or if it is corrupt
+//
+static inline int next_delta(trace_reader *reader, uint32_t *pc,
+                             uint32_t *target, uint8_t *flags) {
+  if (reader->pos >= reader->count)
+    return 0;
+  if (reader->pos % reader->block_records == 0)
+    delta_block(reader, reader->pos / reader->block_records);
+  if (reader->cursor >= reader->end) {
+    fprintf(stderr, "Warning: delta trace is corrupt or truncated\n");
+    reader->pos = reader->count;
+    return 0;
+  }
+  reader->cursor =
+      delta_decode(reader->cursor, reader->delta, pc, target, flags);
+  reader->pos++;
+  return 1;
+}
+
+static int read_mapped(trace_reader *reader, uint32_t *pc, uint32_t *target,
+                       uint32_t *outcome, uint32_t *condition, uint32_t *call,
+                       uint32_t *ret, uint32_t *direct) {
+  if (reader->format == FORMAT_DELTA) {
+    uint8_t flags;
+    if (!next_delta(reader, pc, target, &flags))
+      return 0;
+    unpack_flags(flags, outcome, condition, call, ret, direct);
+    return 1;
+  }
+  if (reader->cursor >= reader->end && !next_chunk(reader))
+    return 0;
+  const uint8_t *p = reader->cursor;
+
+  if (reader->format == FORMAT_BINARY) {
+    *pc = load_u32(p);
+    *target = load_u32(p + 4);
+    unpack_flags(p[8], outcome, condition, call, ret, direct);
+    reader->cursor = p + TRACE_RECORD_SIZE;
+  } else if (reader->simd) {
+    reader->cursor = (const uint8_t *)parse_line_avx2(
+        (const char *)p, pc, target, outcome, condition, call, ret, direct);
+  } else {
+    reader->cursor = (const uint8_t *)parse_line(
+        (const char *)p, pc, target, outcome, condition, call, ret, direct);
+  }
+  reader->pos++;
+
+  return 1;
+}
+
+// Copies a record read from a .bz2 into the pending cache entry
+//
+static void cache_record(trace_reader *reader, int ok, uint32_t pc,
+                         uint32_t target, uint32_t outcome, uint32_t condition,
+                         uint32_t call, uint32_t ret, uint32_t direct) {
+  if (!ok) {
+    reader->cache_done = 1;
+    return;
+  }
+  trace_write_record(reader->cache_out, pc, target,
+                     trace_pack_flags(outcome, condition, call, ret, direct));
+  reader->cache_count++;
+}
+
+int trace_read(trace_reader *reader, uint32_t *pc, uint32_t *target,
+               uint32_t *outcome, uint32_t *condition, uint32_t *call,
+               uint32_t *ret, uint32_t *direct) {
+  if (reader->map != NULL) {
+    int ok = read_mapped(reader, pc, target, outcome, condition, call, ret,
+                         direct);
+    if (reader->cache_out != NULL)
+      cache_record(reader, ok, *pc, *target, *outcome, *condition, *call,
+                   *ret, *direct);
+    return ok;
+  }
+  int ok = reader->format == FORMAT_BINARY
+               ? read_binary(reader, pc, target, outcome, condition, call,
+                             ret, direct)
+               : read_text(reader, pc, target, outcome, condition, call, ret,
+                           direct);
+  reader->pos += ok;
+  return ok;
+}
+
+// Moves past 'n' records of mapped text by finding their newlines,
+// without parsing them
+//
+// Returns False if the trace ends first
+//
+static int skip_lines(trace_reader *reader, uint64_t n) {
+  for (; n > 0; n--) {
+    if (reader->cursor >= reader->end && !next_chunk(reader))
+      return 0;
+    const uint8_t *nl = (const uint8_t *)memchr(
+        reader->cursor, '\n', (size_t)(reader->end - reader->cursor));
+    // The last line may lack its newline
+    reader->cursor = nl != NULL ? nl + 1 : reader->end;
+    reader->pos++;
+  }
+  return 1;
+}
+
+int trace_seek(trace_reader *reader, uint64_t index) {
+  if (reader->format == FORMAT_DELTA) {
+    // Jump to the block holding 'index' and decode up to it
+    if (index > reader->count)
+      return 0;
+    reader->pos = index - index % reader->block_records;
+    uint32_t pc, target;
+    uint8_t flags;
+    while (reader->pos < index)
+      if (!next_delta(reader, &pc, &target, &flags))
+        return 0;
+    return 1;
+  }
+
+  if (reader->map != NULL && reader->bz == NULL) {
+    if (reader->format == FORMAT_BINARY) {
+      if (index > (uint64_t)(reader->end - reader->data) / TRACE_RECORD_SIZE)
+        return 0;
+      reader->cursor = reader->data + index * TRACE_RECORD_SIZE;
+      reader->pos = index;
+      return 1;
+    }
+    if (index < reader->pos) {
+      reader->cursor = reader->data;
+      reader->pos = 0;
+    }
+  }
+  if (index < reader->pos)
+    return 0;
+
+  // Records headed for a cache entry still have to be decoded
+  if (reader->map != NULL && reader->format == FORMAT_TEXT &&
+      reader->cache_out == NULL)
+    return skip_lines(reader, index - reader->pos);
+
+  uint32_t pc, target, outcome, condition, call, ret, direct;
+  while (reader->pos < index)
+    if (!trace_read(reader, &pc, &target, &outcome, &condition, &call, &ret,
+                    &direct))
+      return 0;
+  return 1;
+}
+
+const char *trace_parser_name(trace_reader *reader) {
+  if (reader->format == FORMAT_DELTA)
+    return reader->cached ? "cached delta" : "delta";
+  if (reader->format == FORMAT_BINARY)
+    return reader->cached ? "cached binary" : "binary";
+  return reader->simd ? "avx2 parser" : "scalar parser";
+}
+
+void trace_close(trace_reader *reader) {
+  if (reader->cache_out != NULL) {
+    if (reader->cache_done && !bz_source_error(reader->bz))
+      trace_cache_commit(reader->cache_out, reader->cache_tmp,
+                         reader->cache_path, reader->cache_count);
+    else
+      trace_cache_abort(reader->cache_out, reader->cache_tmp);
+  }
+  free(reader->cache_path);
+  if (reader->bz != NULL)
+    bz_source_stop(reader->bz);
+  if (reader->map != NULL)
+    munmap(reader->map, reader->map_len);
+  if (reader->stream != NULL)
+    fclose(reader->stream);
+  free(reader->delta);
+  free(reader->line);
+  free(reader);
+}
+
+//------------------------------------//
+//         In-Memory Trace            //
+//------------------------------------//
+
+// Grows the columns of 'trace' to hold at least 'cap' records
+//
+static int trace_reserve(branch_trace *trace, uint64_t *capacity,
+                         uint64_t cap) {
+  if (cap <= *capacity)
+    return 1;
+  uint32_t *pc = (uint32_t *)realloc(trace->pc, cap * sizeof(uint32_t));
+  if (pc != NULL)
+    trace->pc = pc;
+  uint32_t *target =
+      (uint32_t *)realloc(trace->target, cap * sizeof(uint32_t));
+  if (target != NULL)
+    trace->target = target;
+  uint8_t *flags = (uint8_t *)realloc(trace->flags, cap);
+  if (flags != NULL)
+    trace->flags = flags;
+  if (pc == NULL || target == NULL || flags == NULL)
+    return 0;
+  *capacity = cap;
+  return 1;
+}
+
+// Assigns the dense pc ids of a loaded trace. The open addressed table of
+// pc -> id is only needed while loading.
+//
+// Returns True if Successful
+//
+static int assign_pc_ids(branch_trace *trace) {
+  trace->pcid = (uint32_t *)malloc((trace->count ? trace->count : 1) *
+                                   sizeof(uint32_t));
+  if (trace->pcid == NULL)
+    return 0;
+
+  int bits = 12;
+  uint32_t *keys = NULL, *ids = NULL;
+  uint32_t capacity = 0;
+  trace->pc_count = 0;
+
+  for (uint64_t i = 0; i < trace->count; i++) {
+    // Keep the table at most half full, and the reverse table in step
+    if (trace->pc_count >= capacity / 2) {
+      capacity = capacity ? 2 * capacity : 1u << bits;
+      bits = __builtin_ctz(capacity);
+      free(keys);
+      free(ids);
+      keys = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+      ids = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+      uint32_t *pcs =
+          (uint32_t *)realloc(trace->pcs, capacity / 2 * sizeof(uint32_t));
+      if (pcs != NULL)
+        trace->pcs = pcs;
+      if (keys == NULL || ids == NULL || pcs == NULL) {
+        free(keys);
+        free(ids);
+        return 0;
+      }
+      memset(ids, 0xff, capacity * sizeof(uint32_t));
+      for (uint32_t id = 0; id < trace->pc_count; id++) {
+        uint32_t h = (trace->pcs[id] * 0x9E3779B1u) >> (32 - bits);
+        while (ids[h] != UINT32_MAX)
+          h = (h + 1) & (capacity - 1);
+        keys[h] = trace->pcs[id];
+        ids[h] = id;
+      }
+    }
+
+    uint32_t pc = trace->pc[i];
+    uint32_t h = (pc * 0x9E3779B1u) >> (32 - bits);
+    while (ids[h] != UINT32_MAX && keys[h] != pc)
+      h = (h + 1) & (capacity - 1);
+    if (ids[h] == UINT32_MAX) {
+      keys[h] = pc;
+      ids[h] = trace->pc_count;
+      trace->pcs[trace->pc_count++] = pc;
+    }
+    trace->pcid[i] = ids[h];
+  }
+
+  free(keys);
+  free(ids);
+  return 1;
+}
+
+// Reads the records of 'reader' into the columns of 'trace'
+//
+// Returns True if Successful
+//
+static int load_records(trace_reader *reader, branch_trace *trace,
+                        uint64_t limit) {
+  memset(trace, 0, sizeof(*trace));
+  uint64_t capacity = 0;
+
+  if (reader->map != NULL && reader->bz == NULL &&
+      reader->format == FORMAT_BINARY) {
+    // Mapped binary: the size is known and the records decode in place
+    uint64_t n = (uint64_t)(reader->end - reader->cursor) / TRACE_RECORD_SIZE;
+    if (n > limit)
+      n = limit;
+    if (!trace_reserve(trace, &capacity, n > 0 ? n : 1))
+      return 0;
+    const uint8_t *p = reader->cursor;
+    for (uint64_t i = 0; i < n; i++, p += TRACE_RECORD_SIZE) {
+      trace->pc[i] = load_u32(p);
+      trace->target[i] = load_u32(p + 4);
+      trace->flags[i] = p[8];
+    }
+    reader->cursor = p;
+    reader->pos += n;
+    trace->count = n;
+    return 1;
+  }
+
+  if (reader->format == FORMAT_DELTA) {
+    uint64_t n = reader->count - reader->pos;
+    if (n > limit)
+      n = limit;
+    if (!trace_reserve(trace, &capacity, n > 0 ? n : 1))
+      return 0;
+    uint64_t i = 0;
+    while (i < n && next_delta(reader, &trace->pc[i], &trace->target[i],
+                               &trace->flags[i]))
+      i++;
+    trace->count = i;
+    return 1;
+  }
+
+  uint32_t pc, target, outcome, condition, call, ret, direct;
+  uint64_t n = 0;
+  while (n < limit && trace_read(reader, &pc, &target, &outcome, &condition,
+                                &call, &ret, &direct)) {
+    if (n == capacity &&
+        !trace_reserve(trace, &capacity, capacity ? 2 * capacity : 1 << 20))
+      return 0;
+    trace->pc[n] = pc;
+    trace->target[n] = target;
+    trace->flags[n] = trace_pack_flags(outcome, condition, call, ret, direct);
+    n++;
+  }
+  trace->count = n;
+  return 1;
+}
+
+int trace_load(trace_reader *reader, branch_trace *trace, uint64_t limit) {
+  return load_records(reader, trace, limit) && assign_pc_ids(trace);
+}
+
+branch_trace trace_slice(const branch_trace &trace, uint64_t first,
+                         uint64_t count) {
+  branch_trace slice = trace;
+  slice.count = count;
+  slice.pc += first;
+  slice.target += first;
+  slice.flags += first;
+  if (slice.pcid != NULL)
+    slice.pcid += first;
+  return slice;
+}
+
+void trace_free(branch_trace *trace) {
+  free(trace->pcid);
+  free(trace->pcs);
+  free(trace->pc);
+  free(trace->target);
+  free(trace->flags);
+  memset(trace, 0, sizeof(*trace));
+}
+
+//------------------------------------//
+//           Trace Writer             //
+//------------------------------------//
+
+void trace_write_header(FILE *out, uint64_t count) {
+  uint8_t header[TRACE_HEADER_SIZE];
+  memcpy(header, TRACE_MAGIC, TRACE_MAGIC_LEN);
+  memcpy(header + TRACE_MAGIC_LEN, &count, sizeof(count));
+  fwrite(header, 1, TRACE_HEADER_SIZE, out);
+}
+
+void trace_write_record(FILE *out, uint32_t pc, uint32_t target,
+                        uint8_t flags) {
+  uint8_t rec[TRACE_RECORD_SIZE];
+  store_u32(rec, pc);
+  store_u32(rec + 4, target);
+  rec[8] = flags;
+  fwrite(rec, 1, TRACE_RECORD_SIZE, out);
+}
+
+int trace_finish_binary(FILE *out, uint64_t count) {
+  if (fseek(out, 0, SEEK_SET))
+    return 0;
+  trace_write_header(out, count);
+  return fflush(out) == 0;
+}
+
+struct trace_delta_writer {
+  FILE *out;
+  uint64_t count;
+  uint64_t offset; // file offset of the block being built
+
+  uint8_t *block;
+  size_t block_len;
+  delta_tables tables;
+
+  uint64_t *index;
+  uint64_t blocks;
+  uint64_t index_cap;
+  int error;
+};
+
+static void write_delta_header(FILE *out, uint64_t count) {
+  uint8_t header[TRACE_DELTA_HEADER_SIZE] = {0};
+  uint32_t block_records = TRACE_DELTA_BLOCK_RECORDS;
+  memcpy(header, TRACE_DELTA_MAGIC, TRACE_MAGIC_LEN);
+  memcpy(header + TRACE_MAGIC_LEN, &count, sizeof(count));
+  memcpy(header + TRACE_MAGIC_LEN + 8, &block_records, sizeof(block_records));
+  fwrite(header, 1, TRACE_DELTA_HEADER_SIZE, out);
+}
+
+trace_delta_writer *trace_delta_open(FILE *out) {
+  trace_delta_writer *writer =
+      (trace_delta_writer *)calloc(1, sizeof(trace_delta_writer));
+  writer->out = out;
+  writer->offset = TRACE_DELTA_HEADER_SIZE;
+  writer->block = (uint8_t *)malloc(TRACE_DELTA_BLOCK_RECORDS * DELTA_RECORD_MAX);
+  write_delta_header(out, 0);
+  return writer;
+}
+
+// Writes out the block being built and notes its offset in the index
+//
+static void flush_delta_block(trace_delta_writer *writer) {
+  if (writer->blocks == writer->index_cap) {
+    writer->index_cap = writer->index_cap ? 2 * writer->index_cap : 256;
+    uint64_t *index = (uint64_t *)realloc(
+        writer->index, writer->index_cap * sizeof(uint64_t));
+    if (index == NULL) {
+      writer->error = 1;
+      return;
+    }
+    writer->index = index;
+  }
+  writer->index[writer->blocks++] = writer->offset;
+
+  if (fwrite(writer->block, 1, writer->block_len, writer->out) !=
+      writer->block_len)
+    writer->error = 1;
+  writer->offset += writer->block_len;
+  writer->block_len = 0;
+  memset(&writer->tables, 0, sizeof(writer->tables));
+}
+
+void trace_delta_write(trace_delta_writer *writer, uint32_t pc,
+                       uint32_t target, uint8_t flags) {
+  uint8_t *p = writer->block + writer->block_len;
+  p = delta_encode(p, &writer->tables, pc, target, flags);
+  writer->block_len = (size_t)(p - writer->block);
+  if (++writer->count % TRACE_DELTA_BLOCK_RECORDS == 0)
+    flush_delta_block(writer);
+}
+
+int trace_delta_finish(trace_delta_writer *writer) {
+  FILE *out = writer->out;
+  if (writer->block_len > 0)
+    flush_delta_block(writer);
+
+  fwrite(writer->index, sizeof(uint64_t), writer->blocks, out);
+  fwrite(&writer->blocks, sizeof(uint64_t), 1, out);
+  fwrite(TRACE_DELTA_INDEX_MAGIC, 1, TRACE_MAGIC_LEN, out);
+
+  int ok = !writer->error && !ferror(out) && !fseek(out, 0, SEEK_SET);
+  if (ok) {
+    write_delta_header(out, writer->count);
+    ok = fflush(out) == 0;
+  }
+
+  free(writer->index);
+  free(writer->block);
+  free(writer);
+  return ok;
+}
@@ -0,0 +1,202 @@
+//========================================================//
+//  trace.h                                               //
+//  Header file for the branch trace readers              //
+//                                                        //
+//  Traces come either as the tab separated text emitted  //
+//  by branchExtractor or as the fixed width or delta     //
+//  coded binary forms written by traceconv, optionally   //
+//  bzip2 compressed                                      //
+//========================================================//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+//------------------------------------//
+//        Binary Trace Format         //
+//------------------------------------//
+
+// A binary trace starts with a 16 byte header: the 8 byte magic below
+// followed by the little endian 64-bit record count. Each record is then
+// TRACE_RECORD_SIZE bytes: pc (u32 LE), target (u32 LE), flags (u8).
+#define TRACE_MAGIC "BPTRACE1"
+#define TRACE_MAGIC_LEN 8
+#define TRACE_HEADER_SIZE 16
+#define TRACE_RECORD_SIZE 9
+
+// Every buffer handed to the text parser is NUL terminated and readable
+// for at least this many bytes past its end, so the SIMD tokenizer can
+// always load a full vector
+#define TRACE_PAD 64
+
+// Bits of the packed flags byte
+#define TRACE_OUTCOME (1 << 0)
+#define TRACE_CONDITION (1 << 1)
+#define TRACE_CALL (1 << 2)
+#define TRACE_RET (1 << 3)
+#define TRACE_DIRECT (1 << 4)
+
+static inline uint8_t trace_pack_flags(uint32_t outcome, uint32_t condition,
+                                       uint32_t call, uint32_t ret,
+                                       uint32_t direct) {
+  return (outcome ? TRACE_OUTCOME : 0) | (condition ? TRACE_CONDITION : 0) |
+         (call ? TRACE_CALL : 0) | (ret ? TRACE_RET : 0) |
+         (direct ? TRACE_DIRECT : 0);
+}
+
+//------------------------------------//
+//        Delta Trace Format          //
+//------------------------------------//
+
+// A delta trace (traceconv -z) starts with a 24 byte header: the magic
+// below, the u64 record count and the u32 number of records per block.
+// Blocks decode independently. Each record is a flags byte holding the
+// TRACE_* bits plus the two hit bits below, then a zigzag varint of the pc
+// minus the previous pc unless the pc is the one that last followed the
+// previous pc, then a zigzag varint of the target minus the pc unless the
+// target is the last one seen for this pc. The file ends with an index:
+// the u64 file offset of every block, the u64 block count and the 8 byte
+// index magic.
+#define TRACE_DELTA_MAGIC "BPTRACEZ"
+#define TRACE_DELTA_HEADER_SIZE 24
+#define TRACE_DELTA_INDEX_MAGIC "BPTZINDX"
+#define TRACE_DELTA_BLOCK_RECORDS 65536
+
+#define TRACE_PC_HIT (1 << 5)
+#define TRACE_TARGET_HIT (1 << 6)
+
+//------------------------------------//
+//           Trace Reader             //
+//------------------------------------//
+
+// Threads used to decode .bz2 traces whose blocks can be split up;
+// 0 picks one per core, 1 forces the serial decoder. The runner lowers it
+// to a share of the cores while it loads several traces at once.
+extern int trace_decode_threads;
+
+// Use the AVX2 text tokenizer when the CPU supports it (default on)
+extern int trace_use_simd;
+
+typedef struct trace_reader trace_reader;
+
+// Wrap an already opened stream. The format is picked from the first
+// bytes of the stream, so pipes (stdin) work for both text and binary.
+// Returns NULL if the stream is not a readable trace.
+//
+trace_reader *trace_open(FILE *stream);
+
+// Opens the trace at 'path'. Regular files are memory mapped and decoded
+// in place, .bz2 files are decompressed on a background thread while they
+// are read; anything else falls back to trace_open. Delta traces can only
+// be read this way, from a regular file.
+// Returns NULL if the file cannot be opened or is not a readable trace.
+//
+trace_reader *trace_open_path(const char *path);
+
+// Reads the next branch record
+//
+// Returns True if Successful
+//
+int trace_read(trace_reader *reader, uint32_t *pc, uint32_t *target,
+               uint32_t *outcome, uint32_t *condition, uint32_t *call,
+               uint32_t *ret, uint32_t *direct);
+
+// Positions the reader so the next trace_read returns record 'index'.
+// Mapped binary and delta traces jump there directly, mapped text skips
+// whole lines without parsing them and other traces read and drop the
+// records in between.
+//
+// Returns True if the trace has at least 'index' records
+//
+int trace_seek(trace_reader *reader, uint64_t index);
+
+// Describes how records are decoded: "avx2 parser" or "scalar parser"
+// for text traces, "binary" or "delta" for the binary formats, with
+// "cached " in front when a .bz2 was read from its decoded cache entry
+//
+const char *trace_parser_name(trace_reader *reader);
+
+// Releases the reader and closes the underlying stream
+//
+void trace_close(trace_reader *reader);
+
+//------------------------------------//
+//         In-Memory Trace            //
+//------------------------------------//
+
+// A whole trace held as columns: record i is pc[i], target[i] and the
+// TRACE_* bits of flags[i]. Once loaded it is never modified, so any
+// number of predictors can walk it.
+//
+// Each distinct pc also gets a dense id, in order of first appearance:
+// pcid[i] is the id of pc[i] and pcs[id] maps it back, so per branch
+// state can live in flat arrays of pc_count entries.
+typedef struct {
+  uint64_t count;
+  uint32_t *pc;
+  uint32_t *target;
+  uint8_t *flags;
+
+  uint32_t *pcid;
+  uint32_t *pcs;
+  uint32_t pc_count;
+} branch_trace;
+
+// Reads the remaining records of 'reader' into 'trace', at most 'limit'
+// of them (UINT64_MAX for all)
+//
+// Returns True if Successful
+//
+int trace_load(trace_reader *reader, branch_trace *trace, uint64_t limit);
+
+// Returns a view of 'count' records of 'trace' starting at record 'first',
+// sharing its columns; the view is never freed on its own
+//
+branch_trace trace_slice(const branch_trace &trace, uint64_t first,
+                         uint64_t count);
+
+// Releases the columns of 'trace'
+//
+void trace_free(branch_trace *trace);
+
+//------------------------------------//
+//           Trace Writer             //
+//------------------------------------//
+
+// Writes the binary header. The record count may be patched later with
+// trace_finish_binary once the number of records is known.
+//
+void trace_write_header(FILE *out, uint64_t count);
+
+// Appends one record in binary form
+//
+void trace_write_record(FILE *out, uint32_t pc, uint32_t target,
+                        uint8_t flags);
+
+// Rewrites the header with the final record count
+//
+// Returns True if Successful
+//
+int trace_finish_binary(FILE *out, uint64_t count);
+
+typedef struct trace_delta_writer trace_delta_writer;
+
+// Starts a delta trace on 'out', which must be seekable
+//
+trace_delta_writer *trace_delta_open(FILE *out);
+
+// Appends one record to the delta trace
+//
+void trace_delta_write(trace_delta_writer *writer, uint32_t pc,
+                       uint32_t target, uint8_t flags);
+
+// Flushes the last block, writes the block index and the final record count
+// and frees the writer. 'out' is left open.
+//
+// Returns True if Successful
+//
+int trace_delta_finish(trace_delta_writer *writer);
+
+#endif
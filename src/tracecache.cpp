@@ -0,0 +1,156 @@
+//========================================================//
+//  tracecache.cpp                                        //
+//  Source file for the decoded trace cache               //
+//                                                        //
+//  Entries are <hash>.bpt files in the cache directory.  //
+//  Their mtime doubles as the last use time, so the      //
+//  least recently used ones are evicted first            //
+//========================================================//
+#include "tracecache.h"
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+int trace_cache_enabled = 1;
+const char *trace_cache_dir = NULL;
+uint64_t trace_cache_limit = 4ull << 30;
+
+// 64-bit FNV-1a over the compressed bytes
+//
+static uint64_t content_hash(const uint8_t *data, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ data[i]) * 0x100000001b3ull;
+  return h ^ len;
+}
+
+// Creates 'dir' and its parents
+//
+// Returns True if the directory exists afterwards
+//
+static int make_dirs(const std::string &dir) {
+  for (size_t i = 1; i <= dir.size(); i++) {
+    if (i == dir.size() || dir[i] == '/') {
+      std::string part = dir.substr(0, i);
+      if (mkdir(part.c_str(), 0755) && errno != EEXIST)
+        return 0;
+    }
+  }
+  return 1;
+}
+
+static std::string cache_dir() {
+  if (trace_cache_dir != NULL)
+    return trace_cache_dir;
+  const char *env = getenv("BP_TRACE_CACHE");
+  if (env != NULL && *env)
+    return env;
+  const char *home = getenv("HOME");
+  if (home == NULL || !*home)
+    return "";
+  return std::string(home) + "/.cache/bp_traces";
+}
+
+char *trace_cache_path(const uint8_t *data, size_t len) {
+  if (!trace_cache_enabled)
+    return NULL;
+
+  std::string dir = cache_dir();
+  if (dir.empty() || !make_dirs(dir))
+    return NULL;
+
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.bpt",
+           (unsigned long long)content_hash(data, len));
+  return strdup((dir + name).c_str());
+}
+
+int trace_cache_touch(const char *path) {
+  return utimensat(AT_FDCWD, path, NULL, 0) == 0;
+}
+
+FILE *trace_cache_create(const char *path, char **tmp_path) {
+  // Several threads of one process may cache the same trace at once
+  static std::atomic<unsigned> serial(0);
+  char suffix[48];
+  snprintf(suffix, sizeof(suffix), ".tmp.%d.%u", (int)getpid(),
+           serial.fetch_add(1));
+  *tmp_path = strdup((std::string(path) + suffix).c_str());
+
+  FILE *out = fopen(*tmp_path, "wb");
+  if (out == NULL) {
+    free(*tmp_path);
+    *tmp_path = NULL;
+    return NULL;
+  }
+  trace_write_header(out, 0);
+  return out;
+}
+
+// Removes the least recently used entries until the cache fits the limit
+//
+static void evict(const std::string &dir) {
+  DIR *d = opendir(dir.c_str());
+  if (d == NULL)
+    return;
+
+  struct entry {
+    struct timespec used;
+    uint64_t size;
+    std::string path;
+  };
+  std::vector<entry> entries;
+  uint64_t total = 0;
+
+  struct dirent *de;
+  while ((de = readdir(d)) != NULL) {
+    size_t n = strlen(de->d_name);
+    if (n < 4 || strcmp(de->d_name + n - 4, ".bpt"))
+      continue;
+    std::string path = dir + "/" + de->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st))
+      continue;
+    entries.push_back({st.st_mtim, (uint64_t)st.st_size, path});
+    total += st.st_size;
+  }
+  closedir(d);
+
+  std::sort(entries.begin(), entries.end(),
+            [](const entry &a, const entry &b) {
+              return a.used.tv_sec != b.used.tv_sec
+                         ? a.used.tv_sec < b.used.tv_sec
+                         : a.used.tv_nsec < b.used.tv_nsec;
+            });
+  for (size_t i = 0; i < entries.size() && total > trace_cache_limit; i++) {
+    if (!unlink(entries[i].path.c_str()))
+      total -= entries[i].size;
+  }
+}
+
+void trace_cache_commit(FILE *out, char *tmp_path, const char *path,
+                        uint64_t count) {
+  if (!trace_finish_binary(out, count) || fclose(out) ||
+      rename(tmp_path, path)) {
+    unlink(tmp_path);
+  } else {
+    std::string dir(path, strrchr(path, '/') - path);
+    evict(dir);
+  }
+  free(tmp_path);
+}
+
+void trace_cache_abort(FILE *out, char *tmp_path) {
+  fclose(out);
+  unlink(tmp_path);
+  free(tmp_path);
+}
@@ -0,0 +1,57 @@
+//========================================================//
+//  tracecache.h                                          //
+//  Header file for the decoded trace cache               //
+//                                                        //
+//  Decompressed .bz2 traces are kept on disk in the      //
+//  binary trace format, keyed by a hash of the .bz2      //
+//  contents, so later runs can map them directly         //
+//========================================================//
+
+#ifndef TRACECACHE_H
+#define TRACECACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+//------------------------------------//
+//       Cache Configuration          //
+//------------------------------------//
+
+extern int trace_cache_enabled;     // Cache .bz2 traces (default on)
+extern const char *trace_cache_dir; // NULL picks $BP_TRACE_CACHE or
+                                    // ~/.cache/bp_traces
+extern uint64_t trace_cache_limit;  // Bytes kept before evicting the least
+                                    // recently used entries
+
+//------------------------------------//
+//          Cache Functions           //
+//------------------------------------//
+
+// Returns the (malloc'd) path of the cache entry for the compressed trace
+// in 'data', or NULL if caching is disabled or no directory is usable
+//
+char *trace_cache_path(const uint8_t *data, size_t len);
+
+// Marks the entry at 'path' as used, for LRU eviction
+//
+// Returns True if the entry exists
+//
+int trace_cache_touch(const char *path);
+
+// Starts writing a new entry for 'path'. The records go to a temporary
+// file (its name stored in 'tmp_path') until trace_cache_commit.
+//
+FILE *trace_cache_create(const char *path, char **tmp_path);
+
+// Finishes the entry with its record count, moves it into place and
+// evicts old entries beyond trace_cache_limit
+//
+void trace_cache_commit(FILE *out, char *tmp_path, const char *path,
+                        uint64_t count);
+
+// Drops an unfinished entry
+//
+void trace_cache_abort(FILE *out, char *tmp_path);
+
+#endif
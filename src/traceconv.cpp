@@ -0,0 +1,73 @@
+//========================================================//
+//  traceconv.cpp                                         //
+//  Converts branch traces to the binary trace formats    //
+//                                                        //
+//  Usage: traceconv [-z] <input> <output>                //
+//  The input may be a .bz2 trace, a text trace or "-"    //
+//  for stdin. -z writes the delta coded format           //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+int main(int argc, char *argv[])
+{
+  int delta = argc > 1 && !strcmp(argv[1], "-z");
+  argv += delta;
+  argc -= delta;
+
+  if (argc != 3)
+  {
+    fprintf(stderr, "Usage: traceconv [-z] <input> <output>\n");
+    fprintf(stderr, "       <input> is a .bz2 or text trace, or - for stdin\n");
+    fprintf(stderr, "       -z      write the delta coded format, which is\n"
+                    "               smaller and supports seeking\n");
+    return 1;
+  }
+
+  trace_reader *reader =
+      strcmp(argv[1], "-") ? trace_open_path(argv[1]) : trace_open(stdin);
+  if (reader == NULL)
+  {
+    fprintf(stderr, "traceconv: cannot read trace %s\n", argv[1]);
+    return 1;
+  }
+
+  FILE *out = fopen(argv[2], "wb");
+  if (out == NULL)
+  {
+    fprintf(stderr, "traceconv: cannot open %s for writing\n", argv[2]);
+    return 1;
+  }
+
+  uint64_t count = 0;
+  uint32_t pc, target, outcome, condition, call, ret, direct;
+
+  trace_delta_writer *writer = delta ? trace_delta_open(out) : NULL;
+  if (!delta)
+    trace_write_header(out, 0);
+  while (trace_read(reader, &pc, &target, &outcome, &condition, &call, &ret,
+                    &direct))
+  {
+    uint8_t flags = trace_pack_flags(outcome, condition, call, ret, direct);
+    if (delta)
+      trace_delta_write(writer, pc, target, flags);
+    else
+      trace_write_record(out, pc, target, flags);
+    count++;
+  }
+
+  int ok = delta ? trace_delta_finish(writer) : trace_finish_binary(out, count);
+  if (!ok || fclose(out))
+  {
+    fprintf(stderr, "traceconv: error writing %s\n", argv[2]);
+    return 1;
+  }
+  trace_close(reader);
+
+  fprintf(stderr, "traceconv: wrote %llu records to %s\n",
+          (unsigned long long)count, argv[2]);
+  return 0;
+}